@@ -6,26 +6,37 @@
 #include <limits.h>
 #include <stdio.h>
 #include <errno.h>
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
 
-
-
-// Board representations with rank / file 0d out to ease computation of overflows
-uint64_t rank_1 = 0xFFFFFFFFFFFFFF00;
-uint64_t rank_2 = 0xFFFFFFFFFFFF00FF;
-uint64_t rank_3 = ~0x0000000000FF0000;
-uint64_t rank_4 = ~0x00000000FF000000;
-uint64_t rank_5 = ~0x000000FF00000000;
-uint64_t rank_6 = ~0x0000FF0000000000;
-uint64_t rank_7 = 0xFF00FFFFFFFFFFFF;
-uint64_t rank_8 = 0x00FFFFFFFFFFFFFF;
-uint64_t file_a = 0xFEFEFEFEFEFEFEFE;
-uint64_t file_b = 0xFDFDFDFDFDFDFDFD;
-uint64_t file_c = ~0x0404040404040404;
-uint64_t file_d = ~0x0808080808080808;
-uint64_t file_e = ~0x1010101010101010;
-uint64_t file_f = ~0x2020202020202020;
-uint64_t file_h = 0x7F7F7F7F7F7F7F7F;
-uint64_t file_g = 0xBFBFBFBFBFBFBFBF;
+/*
+ * Forces a function to be inlined. Hot routines taking a side are written 
+ * once and inlined into a copy per side where side is a constant, so the 
+ * compiler folds away the colour branches and shift directions.
+*/
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+
+
+// Board representations with rank / file 0d out to ease computation of overflows.
+// Constant so the compiler can fold them into the shifts that use them.
+const uint64_t rank_1 = 0xFFFFFFFFFFFFFF00;
+const uint64_t rank_2 = 0xFFFFFFFFFFFF00FF;
+const uint64_t rank_3 = ~0x0000000000FF0000;
+const uint64_t rank_4 = ~0x00000000FF000000;
+const uint64_t rank_5 = ~0x000000FF00000000;
+const uint64_t rank_6 = ~0x0000FF0000000000;
+const uint64_t rank_7 = 0xFF00FFFFFFFFFFFF;
+const uint64_t rank_8 = 0x00FFFFFFFFFFFFFF;
+const uint64_t file_a = 0xFEFEFEFEFEFEFEFE;
+const uint64_t file_b = 0xFDFDFDFDFDFDFDFD;
+const uint64_t file_c = ~0x0404040404040404;
+const uint64_t file_d = ~0x0808080808080808;
+const uint64_t file_e = ~0x1010101010101010;
+const uint64_t file_f = ~0x2020202020202020;
+const uint64_t file_h = 0x7F7F7F7F7F7F7F7F;
+const uint64_t file_g = 0xBFBFBFBFBFBFBFBF;
 
 /*
  * Struct containing current board state. 
@@ -36,38 +47,166 @@ uint64_t file_g = 0xBFBFBFBFBFBFBFBF;
  */
 
 typedef struct board {
-    uint64_t pawn_w;
-    uint64_t pawn_b;
-    uint64_t queen_w;
-    uint64_t queen_b;
-    uint64_t king_w;
-    uint64_t king_b;
-    uint64_t rook_w;
-    uint64_t rook_b;
-    uint64_t knight_w;
-    uint64_t knight_b;
-    uint64_t bishop_w;
-    uint64_t bishop_b;
-
-    uint64_t black;
-    uint64_t white;
-
-    // True if either rook and king is in correct position to castle.
-    // Does not track whether there are pieces obstructing 
-    // l and r denote castle that is a left or right shift from the repective king
-    int castle_w_l;
-    int castle_w_r;
-    int castle_b_l;
-    int castle_b_r;
-
-    // 1 if white's turn, 0 if black's
-    int turn; 
-
-    // Boolean to track if last move involved two space pawn push for en passant
-    int en_passant;
-    uint64_t en_passant_target;
+    // Pieces of both sides by type, indexed PAWN to KING.
+    uint64_t pieces[6];
+    // All pieces of each side, indexed BLACK and WHITE.
+    uint64_t colors[2];
+
+    // Zobrist hash of the position, kept up to date by do_move and undo_move.
+    uint64_t key;
+    // Zobrist hash of the pawns and kings only, keys the pawn structure cache.
+    uint64_t pawn_key;
+
+    // Material and piece square totals from white's view, and the game phase, kept up to date like key.
+    int16_t mg_score;
+    int16_t eg_score;
+    uint8_t phase;
+    // Plies since the last capture or pawn move, or since a null move in search. Saturates at 255.
+    uint8_t halfmove;
+
+    // Side to move, castle rights and en passant file, see STATE_TURN.
+    uint16_t state;
+
+    // Mailbox of what stands on each square, two squares per byte, see square_code. 
+    // Kept in sync with the bitboards.
+    uint8_t squares[32];
 } board;
 
+// Board copies happen at every search ply, keep them to at most 128 bytes. Boards 
+// are not cache line aligned, so a copy may still touch three lines.
+_Static_assert(sizeof(board) <= 128, "board must be at most 128 bytes");
+
+enum { BLACK, WHITE };
+enum { PAWN, KNIGHT, BISHOP, ROOK, QUEEN, KING, NO_PIECE };
+
+char file_names[8] = {'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h'};
+char rank_names[8] = {'1', '2', '3', '4', '5', '6', '7', '8'};
+// Piece letters indexed by side then piece, lower case for black.
+char piece_names[2][6] = {{'p', 'n', 'b', 'r', 'q', 'k'}, {'P', 'N', 'B', 'R', 'Q', 'K'}};
+
+/*
+ * Castle rights as packed into the low bits of the board state. l and r 
+ * denote castling toward the a and h files.
+*/
+enum { CASTLE_W_L = 1, CASTLE_W_R = 2, CASTLE_B_L = 4, CASTLE_B_R = 8 };
+
+/*
+ * Layout of board state: castle rights in bits 0-3, the en passant file 
+ * plus one in bits 4-7 or 0 if there is no en passant capture, and the 
+ * side to move in bit 8.
+*/
+#define STATE_CASTLE 0x00F
+#define STATE_EN_PASSANT 0x0F0
+#define STATE_TURN 0x100
+
+/*
+ * Returns 1 if white is to move, 0 if black.
+*/
+int side_to_move(board* b) {
+    return (b->state & STATE_TURN) ? WHITE: BLACK;
+}
+
+void set_side_to_move(board* b, int side) {
+    b->state = (b->state & ~STATE_TURN) | ((side) ? STATE_TURN: 0);
+}
+
+int get_castle_rights(board* b) {
+    return b->state & STATE_CASTLE;
+}
+
+void set_castle_rights(board* b, int rights) {
+    b->state = (b->state & ~STATE_CASTLE) | (rights & STATE_CASTLE);
+}
+
+/*
+ * Returns the square a pawn capturing en passant would move to, or 0 if 
+ * there is none. Only the file is stored, the rank follows from the side 
+ * to move.
+*/
+int en_passant_square(board* b) {
+    int file = (b->state & STATE_EN_PASSANT) >> 4;
+    if (!file) return 0;
+    return (b->state & STATE_TURN) ? 40 + file - 1: 16 + file - 1;
+}
+
+uint64_t en_passant_target(board* b) {
+    int sq = en_passant_square(b);
+    return (sq) ? (uint64_t) 1 << sq: 0;
+}
+
+/*
+ * Sets the en passant target to square sq, or clears it if sq is 0.
+*/
+void set_en_passant(board* b, int sq) {
+    b->state = (b->state & ~STATE_EN_PASSANT) | ((sq) ? (sq % 8 + 1) << 4: 0);
+}
+
+/*
+ * Mailbox entries pack the side above the piece, so one load tells what 
+ * stands on a square. Empty squares hold NO_PIECE. Entries are four bits, 
+ * the even square of each pair in the low half of its byte.
+*/
+int mailbox_code(int side, int piece) {
+    return side << 3 | piece;
+}
+
+int square_code(board* b, int sq) {
+    return (b->squares[sq >> 1] >> ((sq & 1) << 2)) & 15;
+}
+
+void set_square_code(board* b, int sq, int code) {
+    int shift = (sq & 1) << 2;
+    b->squares[sq >> 1] = (b->squares[sq >> 1] & ~(15 << shift)) | code << shift;
+}
+
+// Byte value for a pair of empty squares.
+#define EMPTY_SQUARES (NO_PIECE << 4 | NO_PIECE)
+
+/*
+ * Moves are packed into 16 bits: bits 0-5 hold the from square, 6-11 the to
+ * square and 12-15 the flags below. Bit 2 of the flags marks a capture and
+ * bit 3 a promotion, in which case the low two bits give the promoted piece.
+ * Right castling is toward the h file, matching CASTLE_W_R.
+*/
+typedef uint16_t move;
+
+enum {
+    QUIET = 0,
+    DOUBLE_PUSH = 1,
+    CASTLE_RIGHT = 2,
+    CASTLE_LEFT = 3,
+    CAPTURE = 4,
+    EN_PASSANT = 5,
+    PROMOTION = 8,
+    PROMOTION_CAPTURE = 12
+};
+
+#define MAX_MOVES 256
+
+typedef struct move_list {
+    move moves[MAX_MOVES];
+    int count;
+} move_list;
+
+/*
+ * Everything do_move changes that the move itself does not encode. Callers
+ * keep one per ply, eg. on the recursion stack, and pass it back to undo_move.
+*/
+typedef struct move_undo {
+    uint8_t piece;
+    uint8_t captured;
+    // Castle rights before the move, one bit each for w_l, w_r, b_l and b_r.
+    uint8_t castle;
+    // En passant target square before the move, 0 if none.
+    uint8_t en_passant;
+    uint8_t phase;
+    uint8_t halfmove;
+    uint64_t key;
+    uint64_t pawn_key;
+    int mg_score;
+    int eg_score;
+} move_undo;
+
 board* board_alloc() {
     board *b = malloc(sizeof(board));
     if (!b) {
@@ -81,31 +220,39 @@ void board_delete(board *b) {
     free(b);
 }
 
-char* make_move_b(uint64_t from, uint64_t to, board* b);
-char* make_move_w(uint64_t from, uint64_t to, board* b);
+int make_move_side(uint64_t from, uint64_t to, board* b, int side);
 int bit_pos_to_int(uint64_t pos);
 void  bit_pos_to_alg(uint64_t pos, char* pos_str);
 uint64_t perft(board* b, int depth);
+uint64_t compute_key(board* b);
+uint64_t compute_pawn_key(board* b);
+void compute_eval(board* b);
+void init_zobrist();
+void init_eval();
+void init_pawn_masks();
+void init_search();
+void set_mailbox(board* b);
+int piece_on(board* b, uint64_t pos, int side);
+static ALWAYS_INLINE uint64_t side_attackers_to(board* b, int sq, uint64_t occupied, int side);
 /* 
  * Returns all pieces for currently active side. 
 */
 uint64_t get_curr_side(board *b) {
-    return (b->turn) ? b->white: b->black;
+    return b->colors[side_to_move(b)];
 }
 
 /* 
  * Returns all pieces for opposing side.
 */
 uint64_t get_opp_side(board *b) {
-    return (!b->turn) ? b->white: b->black;
+    return b->colors[!side_to_move(b)];
 }
 
-/* 
- * Fills each side, white and black, in bitboard with respective sides pieces. 
+/*
+ * Returns the pieces of type piece belonging to side.
 */
-void set_sides(board *b) {
-    b->white = b->pawn_w | b->queen_w | b->king_w | b->bishop_w | b->knight_w | b->rook_w;
-    b->black = b->pawn_b | b->queen_b | b->king_b | b->bishop_b | b->knight_b | b->rook_b;
+uint64_t piece_board(board* b, int side, int piece) {
+    return b->pieces[piece] & b->colors[side];
 }
 
 /* 
@@ -113,30 +260,22 @@ void set_sides(board *b) {
  * Also initializes boolean values for check and castling.
 */
 int set_standard(board* b) {
-    b->pawn_w = 0x000000000000FF00;
-    b->pawn_b = 0x00FF000000000000;
-    b->queen_w = 0x0000000000000008;
-    b->queen_b = 0x0800000000000000;
-    b->king_w = 0x0000000000000010;
-    b->king_b = 0x1000000000000000;
-    b->rook_w = 0x0000000000000081;
-    b->rook_b = 0x8100000000000000;
-    b->knight_w = 0x0000000000000042;
-    b->knight_b = 0x4200000000000000;
-    b->bishop_w = 0x0000000000000024;
-    b->bishop_b = 0x2400000000000000;
-
-    set_sides(b);
-
-    b->castle_w_l = 0;
-    b->castle_w_r = 0;
-    b->castle_b_l = 0;
-    b->castle_b_r = 0;
-
-    b->turn = 1;
-
-    b->en_passant = 0;
-    b->en_passant_target = 0;
+    b->pieces[PAWN] = 0x00FF00000000FF00;
+    b->pieces[KNIGHT] = 0x4200000000000042;
+    b->pieces[BISHOP] = 0x2400000000000024;
+    b->pieces[ROOK] = 0x8100000000000081;
+    b->pieces[QUEEN] = 0x0800000000000008;
+    b->pieces[KING] = 0x1000000000000010;
+    b->colors[WHITE] = 0x000000000000FFFF;
+    b->colors[BLACK] = 0xFFFF000000000000;
+    set_mailbox(b);
+
+    b->state = STATE_TURN | CASTLE_W_L | CASTLE_W_R | CASTLE_B_L | CASTLE_B_R;
+    b->halfmove = 0;
+
+    b->key = compute_key(b);
+    b->pawn_key = compute_pawn_key(b);
+    compute_eval(b);
 
     return 0;
 }
@@ -145,116 +284,53 @@ int set_standard(board* b) {
  * Initializes empty board.  
 */
 int set_empty(board* b) {
-    b->pawn_w = 0;
-    b->pawn_b = 0;
-    b->queen_w = 0;
-    b->queen_b = 0;
-    b->king_w = 0;
-    b->king_b = 0;
-    b->rook_w = 0;
-    b->rook_b = 0;
-    b->knight_w = 0;
-    b->knight_b = 0;
-    b->bishop_w = 0;
-    b->bishop_b = 0;
-
-    b->white = 0;
-    b->black = 0;
-
-    b->castle_w_l = 0;
-    b->castle_w_r = 0;
-    b->castle_b_l = 0;
-    b->castle_b_r = 0;
-
-    b->turn = 1;
+    memset(b->pieces, 0, sizeof(b->pieces));
+    memset(b->colors, 0, sizeof(b->colors));
+    memset(b->squares, EMPTY_SQUARES, sizeof(b->squares));
+
+    b->state = STATE_TURN;
+
+    b->key = 0;
+    b->pawn_key = 0;
+    b->mg_score = 0;
+    b->eg_score = 0;
+    b->phase = 0;
+    b->halfmove = 0;
 
     return 0;
 }
 
+/*
+ * True if both boards hold the same pieces, castle rights and side to move.
+*/
 int board_equals(board* b1, board* b2) {
-    int p_w = b1->pawn_w == b2->pawn_w;
-    int p_b = b1->pawn_b == b2->pawn_b;
-    int q_w = b1->queen_w == b2->queen_w;
-    int q_b = b1->queen_b ==  b2->queen_b;
-    int k_w = b1->king_w == b2->king_w;
-    int k_b = b1->king_b == b2->king_b;
-    int r_w = b1->rook_w == b2->rook_w;
-    int r_b = b1->rook_b == b2->rook_b;
-    int n_w = b1->knight_w == b2->knight_w;
-    int n_b = b1->knight_b == b2->knight_b;
-    int b_w = b1->bishop_w == b2->bishop_w;
-    int b_b = b1->bishop_b == b2->bishop_b;
-
-    int w = b1->white == b2->white;
-    int b = b1->black == b2->black;
-
-    int c_w_l = b1->castle_w_l == b2->castle_w_l;
-    int c_w_r = b1->castle_w_r == b2->castle_w_r;
-    int c_b_l = b1->castle_b_l == b2->castle_b_l;
-    int c_b_r = b1->castle_b_r == b2->castle_b_r;
-
-    int t = b1->turn == b2->turn;
-    return p_w & p_b & q_w & q_b & q_w & k_w & k_b & r_w & r_b & n_w & n_b & b_b & b_w \
-          & w & b & c_w_r & c_w_l & c_b_r & c_b_l & t;
+    return !memcmp(b1->pieces, b2->pieces, sizeof(b1->pieces)) \
+        && !memcmp(b1->colors, b2->colors, sizeof(b1->colors)) \
+        && !memcmp(b1->squares, b2->squares, sizeof(b1->squares)) \
+        && (b1->state & ~STATE_EN_PASSANT) == (b2->state & ~STATE_EN_PASSANT);
 }
 
+/*
+ * Returns the board as text, rank 8 first, with - for empty squares. The 
+ * caller frees the string.
+*/
 char*  board_string(board* b) {
-    uint64_t mask = 0x0100000000000000;
-    char* b_str = calloc(sizeof(char), 73);
-    strcat(b_str, "\n");
-    for (int i = 1; i <= 64; i++) {
-        uint64_t pawn_w = b->pawn_w & mask;
-        uint64_t queen_w = b->queen_w & mask;
-        uint64_t king_w = b->king_w & mask;
-        uint64_t rook_w = b->rook_w & mask;
-        uint64_t knight_w = b->knight_w & mask;
-        uint64_t bishop_w = b->bishop_w & mask;
-        uint64_t pawn_b = b->pawn_b & mask;
-        uint64_t queen_b = b->queen_b & mask;
-        uint64_t king_b = b->king_b & mask;
-        uint64_t rook_b = b->rook_b & mask;
-        uint64_t knight_b = b->knight_b & mask;
-        uint64_t bishop_b = b->bishop_b & mask;
-
-        if (pawn_w) {
-            strcat(b_str, "P");
-        } else if (pawn_b) {
-            strcat(b_str, "p");
-        } else if (queen_w) {
-            strcat(b_str, "Q");
-        } else if (queen_b) {
-            strcat(b_str, "q");
-        } else if (king_w) {
-            strcat(b_str, "K");
-        } else if (king_b) {
-            strcat(b_str, "k");
-        } else if (rook_w) {
-            strcat(b_str, "R");
-        } else if (rook_b) {
-            strcat(b_str, "r");
-        } else if (knight_w) {
-            strcat(b_str, "N");
-        } else if (knight_b) {
-            strcat(b_str, "n");
-        } else if (bishop_w) {
-            strcat(b_str, "B");
-        } else if (bishop_b) {
-            strcat(b_str, "b");
-        } else {
-            strcat(b_str, "-");
-        } 
-
-        if (!(i % 8)) {
-            strcat(b_str, "\n");
-            mask = mask >> 15;
-            continue;
+    // Leading newline, eight ranks of eight squares and a newline, trailing newline and terminator.
+    char* b_str = calloc(sizeof(char), 1 + 8 * 9 + 1 + 1);
+    if (!b_str) return NULL;
+    int n = 0;
+    b_str[n++] = '\n';
+    for (int rank = 7; rank >= 0; rank--) {
+        for (int file = 0; file < 8; file++) {
+            int code = square_code(b, rank * 8 + file);
+            b_str[n++] = (code == NO_PIECE) ? '-': piece_names[code >> 3][code & 7];
         }
-
-        mask = mask << 1;
+        b_str[n++] = '\n';
     }
-    strcat(b_str, "\n");
+    b_str[n++] = '\n';
     return b_str;
 }
+
 /* 
  * Generates all legal moves for the king and returns them in one combined board. 
  * Requires both castling booleans for the current side to generate castling move for king. 
@@ -286,633 +362,426 @@ uint64_t knight_move_board(uint64_t knight, uint64_t own_side) {
     return (pos_1 | pos_2 | pos_3 | pos_4 | pos_5 | pos_6 | pos_7 | pos_8) & ~own_side;
 }
 
-uint64_t pawn_w_move_board(uint64_t pawn, uint64_t white, uint64_t black) {
-    // Left diagonal attack
-    uint64_t pos_1 = ((pawn & file_a) << 7) & black;
-    // Forward one
-    uint64_t pos_2 = (pawn << 8) & ~black;
-    // Right diagonal attack
-    uint64_t pos_3 = ((pawn & file_h) << 9) & black;
-    // Two step forward 
-    uint64_t pos_4 = ((pawn & ~rank_2) << 8 & ~black & ~white) << 8 & ~black;
-
-    return (pos_1 | pos_2 | pos_3 | pos_4) & ~white;
+/*
+ * Pushes and captures for pawns of side, white moving up the board and 
+ * black down.
+*/
+static ALWAYS_INLINE uint64_t pawn_move_board(uint64_t pawn, uint64_t own_side, uint64_t other_side, int side) {
+    uint64_t empty = ~(own_side | other_side);
+    if (side) {
+        // Left and right diagonal attacks
+        uint64_t captures = (((pawn & file_a) << 7) | ((pawn & file_h) << 9)) & other_side;
+        // Forward one, then two from the starting rank if both squares are free.
+        uint64_t single = (pawn << 8) & empty;
+        uint64_t double_push = ((single & ~rank_3) << 8) & empty;
+        return captures | single | double_push;
+    }
+    uint64_t captures = (((pawn & file_a) >> 9) | ((pawn & file_h) >> 7)) & other_side;
+    uint64_t single = (pawn >> 8) & empty;
+    uint64_t double_push = ((single & ~rank_6) >> 8) & empty;
+    return captures | single | double_push;
 }
 
-uint64_t pawn_b_move_board(uint64_t pawn, uint64_t white, uint64_t black) {
-    // Left diagonal attack
-    uint64_t pos_1 = ((pawn & file_a) >> 9) & white;
-    // Forward one
-    uint64_t pos_2 = (pawn >> 8) & ~white;
-    // Right diagonal attack
-    uint64_t pos_3 = ((pawn & file_h) >> 7) & white;
-    // Two step forward, & with pos_2 to make sure intermediate space is free.
-    uint64_t pos_4 = ((pawn & ~rank_7) >> 8 & ~black & ~white) >> 8 & ~white;
-
-    return (pos_1 | pos_2 | pos_3 | pos_4) & ~black;
+/*
+ * Attacks of a single knight, king or pawn on each square, filled by 
+ * init_step_attacks. Lookups replace the shifts for one piece, set-wise 
+ * shifts stay in use for whole sets of pawns.
+*/
+uint64_t knight_steps[64];
+uint64_t king_steps[64];
+// Diagonal captures of a pawn of each side, indexed BLACK and WHITE.
+uint64_t pawn_steps[2][64];
+
+void init_step_attacks() {
+    for (int sq = 0; sq < 64; sq++) {
+        uint64_t pos = (uint64_t) 1 << sq;
+        knight_steps[sq] = knight_move_board(pos, 0);
+        king_steps[sq] = king_move_board(pos, 0, 0);
+        pawn_steps[WHITE][sq] = ((pos & file_a) << 7) | ((pos & file_h) << 9);
+        pawn_steps[BLACK][sq] = ((pos & file_a) >> 9) | ((pos & file_h) >> 7);
+    }
 }
 
-uint64_t rook_move_board(uint64_t rook, uint64_t own_side, uint64_t other_side) {
-    // North ray 
-    uint64_t north_ray = (rook << 8) & ~own_side;
-    north_ray |= ((north_ray & ~other_side) << 8) & ~own_side;
-    north_ray |= ((north_ray & ~other_side) << 8) & ~own_side;
-    north_ray |= ((north_ray & ~other_side) << 8) & ~own_side;
-    north_ray |= ((north_ray & ~other_side) << 8) & ~own_side;
-    north_ray |= ((north_ray & ~other_side) << 8) & ~own_side;
-    north_ray |= ((north_ray & ~other_side) << 8) & ~own_side;
-
-    // South ray 
-    uint64_t south_ray = (rook >> 8) & ~own_side;
-    south_ray |= ((south_ray & ~other_side) >> 8) & ~own_side;
-    south_ray |= ((south_ray & ~other_side) >> 8) & ~own_side;
-    south_ray |= ((south_ray & ~other_side) >> 8) & ~own_side;
-    south_ray |= ((south_ray & ~other_side) >> 8) & ~own_side;
-    south_ray |= ((south_ray & ~other_side) >> 8) & ~own_side;
-    south_ray |= ((south_ray & ~other_side) >> 8) & ~own_side;
-
-    // East ray 
-    uint64_t east_ray = ((rook & file_h) << 1) & ~own_side;
-    east_ray |= ((east_ray & file_h & ~other_side) << 1) & ~own_side;
-    east_ray |= ((east_ray & file_h & ~other_side) << 1) & ~own_side;
-    east_ray |= ((east_ray & file_h & ~other_side) << 1) & ~own_side;
-    east_ray |= ((east_ray & file_h & ~other_side) << 1) & ~own_side;
-    east_ray |= ((east_ray & file_h & ~other_side) << 1) & ~own_side;
-    east_ray |= ((east_ray & file_h & ~other_side) << 1) & ~own_side;
-
-    // West ray 
-    uint64_t west_ray = ((rook & file_a) >> 1) & ~own_side;
-    west_ray |= ((west_ray & file_a & ~other_side) >> 1) & ~own_side;
-    west_ray |= ((west_ray & file_a & ~other_side) >> 1) & ~own_side;
-    west_ray |= ((west_ray & file_a & ~other_side) >> 1) & ~own_side;
-    west_ray |= ((west_ray & file_a & ~other_side) >> 1) & ~own_side;
-    west_ray |= ((west_ray & file_a & ~other_side) >> 1) & ~own_side;
-    west_ray |= ((west_ray & file_a & ~other_side) >> 1) & ~own_side;
-
-    return north_ray | south_ray | east_ray | west_ray;
+uint64_t knight_attacks(int sq) {
+    return knight_steps[sq];
 }
 
-uint64_t rook_attacks_to_piece(uint64_t rook, uint64_t own_side, uint64_t other_side, uint64_t piece) {
-    // North ray 
-    uint64_t north_ray = (rook << 8) & ~own_side;
-    north_ray |= ((north_ray & ~other_side) << 8) & ~own_side;
-    north_ray |= ((north_ray & ~other_side) << 8) & ~own_side;
-    north_ray |= ((north_ray & ~other_side) << 8) & ~own_side;
-    north_ray |= ((north_ray & ~other_side) << 8) & ~own_side;
-    north_ray |= ((north_ray & ~other_side) << 8) & ~own_side;
-    north_ray |= ((north_ray & ~other_side) << 8) & ~own_side;
-
-    if (!(north_ray & piece)) north_ray = 0;
-
-    // South ray 
-    uint64_t south_ray = (rook >> 8) & ~own_side;
-    south_ray |= ((south_ray & ~other_side) >> 8) & ~own_side;
-    south_ray |= ((south_ray & ~other_side) >> 8) & ~own_side;
-    south_ray |= ((south_ray & ~other_side) >> 8) & ~own_side;
-    south_ray |= ((south_ray & ~other_side) >> 8) & ~own_side;
-    south_ray |= ((south_ray & ~other_side) >> 8) & ~own_side;
-    south_ray |= ((south_ray & ~other_side) >> 8) & ~own_side;
-
-    if (!(south_ray & piece)) south_ray = 0;
-
-    // East ray 
-    uint64_t east_ray = ((rook & file_h) << 1) & ~own_side;
-    east_ray |= ((east_ray & file_h & ~other_side) << 1) & ~own_side;
-    east_ray |= ((east_ray & file_h & ~other_side) << 1) & ~own_side;
-    east_ray |= ((east_ray & file_h & ~other_side) << 1) & ~own_side;
-    east_ray |= ((east_ray & file_h & ~other_side) << 1) & ~own_side;
-    east_ray |= ((east_ray & file_h & ~other_side) << 1) & ~own_side;
-    east_ray |= ((east_ray & file_h & ~other_side) << 1) & ~own_side;
-
-    if (!(east_ray & piece)) east_ray = 0;
-
-    // West ray 
-    uint64_t west_ray = ((rook & file_a) >> 1) & ~own_side;
-    west_ray |= ((west_ray & file_a & ~other_side) >> 1) & ~own_side;
-    west_ray |= ((west_ray & file_a & ~other_side) >> 1) & ~own_side;
-    west_ray |= ((west_ray & file_a & ~other_side) >> 1) & ~own_side;
-    west_ray |= ((west_ray & file_a & ~other_side) >> 1) & ~own_side;
-    west_ray |= ((west_ray & file_a & ~other_side) >> 1) & ~own_side;
-    west_ray |= ((west_ray & file_a & ~other_side) >> 1) & ~own_side;
-
-    if (!(west_ray & piece)) west_ray = 0;
-
-    return north_ray | south_ray | east_ray | west_ray;
+uint64_t king_attacks(int sq) {
+    return king_steps[sq];
 }
 
-uint64_t bishop_attacks_to_piece(uint64_t bishop, uint64_t own_side, uint64_t other_side, uint64_t piece) {
-    uint64_t ne_ray = ((bishop & file_h) << 9) & ~own_side;
-    ne_ray |= ((ne_ray & file_h & ~other_side) << 9) & ~own_side;
-    ne_ray |= ((ne_ray & file_h & ~other_side) << 9) & ~own_side;
-    ne_ray |= ((ne_ray & file_h & ~other_side) << 9) & ~own_side;
-    ne_ray |= ((ne_ray & file_h & ~other_side) << 9) & ~own_side;
-    ne_ray |= ((ne_ray & file_h & ~other_side) << 9) & ~own_side;
-    ne_ray |= ((ne_ray & file_h & ~other_side) << 9) & ~own_side;
+/*
+ * Returns squares a pawn of side on sq attacks.
+*/
+uint64_t pawn_attacks(int side, int sq) {
+    return pawn_steps[side][sq];
+}
 
-    if (!(ne_ray & piece)) ne_ray = 0;
+/*
+ * Sliding piece attack tables (fancy magic bitboards).
+ * For each square the relevant blocker squares (board edges removed) are
+ * hashed with a magic multiplier into a per square slice of a shared table,
+ * so the attacks for any occupancy are one multiply, shift and load.
+ * On BMI2 hosts the slice is instead indexed by PEXT of the occupancy with
+ * the blocker mask. Both backends share the same tables and interface; the
+ * backend is picked at startup by init_tables().
+*/
+typedef struct magic {
+    uint64_t mask;
+    uint64_t magic;
+    uint64_t* attacks;
+    int shift;
+} magic;
+
+magic rook_magics[64];
+magic bishop_magics[64];
+uint64_t rook_table[0x19000];
+uint64_t bishop_table[0x1480];
+
+// File and rank steps for each ray direction. Rook directions first, then bishop.
+enum { NORTH, SOUTH, EAST, WEST, NORTH_EAST, SOUTH_EAST, SOUTH_WEST, NORTH_WEST };
+int ray_dirs[8][2] = {{0, 1}, {0, -1}, {1, 0}, {-1, 0}, {1, 1}, {1, -1}, {-1, -1}, {-1, 1}};
+
+// Rays from each square on an empty board, indexed by direction then square.
+uint64_t rays[8][64];
+int opposite_dir[8] = {SOUTH, NORTH, WEST, EAST, SOUTH_WEST, NORTH_WEST, NORTH_EAST, SOUTH_EAST};
+
+// For two squares on a shared rank, file or diagonal, the squares strictly
+// between them and the whole line through them. Zero for unaligned squares.
+uint64_t between[64][64];
+uint64_t line[64][64];
 
-    uint64_t se_ray = ((bishop & file_h) >> 7) & ~own_side;
-    se_ray |= ((se_ray & file_h & ~other_side) >> 7) & ~own_side;
-    se_ray |= ((se_ray & file_h & ~other_side) >> 7) & ~own_side;
-    se_ray |= ((se_ray & file_h & ~other_side) >> 7) & ~own_side;
-    se_ray |= ((se_ray & file_h & ~other_side) >> 7) & ~own_side;
-    se_ray |= ((se_ray & file_h & ~other_side) >> 7) & ~own_side;
-    se_ray |= ((se_ray & file_h & ~other_side) >> 7) & ~own_side;
+/*
+ * Returns index of least significant set bit and clears it from the board.
+*/
+int pop_lsb(uint64_t* bb) {
+    int sq = __builtin_ctzll(*bb);
+    *bb &= *bb - 1;
+    return sq;
+}
 
-    if (!(se_ray & piece)) se_ray = 0;
+/*
+ * Walks one direction a square at a time until blocked. Only used to fill
+ * the lookup tables, never during move generation.
+*/
+uint64_t ray_attacks(int sq, uint64_t occupied, int dir[2]) {
+    uint64_t attacks = 0;
+    int file = sq % 8 + dir[0];
+    int rank = sq / 8 + dir[1];
+    while (file >= 0 && file < 8 && rank >= 0 && rank < 8) {
+        uint64_t pos = (uint64_t) 1 << (rank * 8 + file);
+        attacks |= pos;
+        if (occupied & pos) break;
+        file += dir[0];
+        rank += dir[1];
+    }
+    return attacks;
+}
 
-    uint64_t sw_ray = ((bishop & file_a) >> 9) & ~own_side;
-    sw_ray |= ((sw_ray & file_a & ~other_side) >> 9) & ~own_side;
-    sw_ray |= ((sw_ray & file_a & ~other_side) >> 9) & ~own_side;
-    sw_ray |= ((sw_ray & file_a & ~other_side) >> 9) & ~own_side;
-    sw_ray |= ((sw_ray & file_a & ~other_side) >> 9) & ~own_side;
-    sw_ray |= ((sw_ray & file_a & ~other_side) >> 9) & ~own_side;
-    sw_ray |= ((sw_ray & file_a & ~other_side) >> 9) & ~own_side;
+uint64_t sliding_attacks(int sq, uint64_t occupied, int dirs[][2]) {
+    return ray_attacks(sq, occupied, dirs[0]) | ray_attacks(sq, occupied, dirs[1]) \
+         | ray_attacks(sq, occupied, dirs[2]) | ray_attacks(sq, occupied, dirs[3]);
+}
 
-    if (!(sw_ray & piece)) sw_ray = 0;
+/*
+ * xorshift64* generator. Reseeded per rank with seeds known to find magics
+ * quickly so table setup is deterministic and takes a few milliseconds.
+*/
+uint64_t magic_seeds[8] = {728, 10316, 55013, 32803, 12281, 15100, 16645, 255};
 
-    uint64_t nw_ray = ((bishop & file_a) << 7) & ~own_side;
-    nw_ray |= ((nw_ray & file_a & ~other_side) << 7) & ~own_side;
-    nw_ray |= ((nw_ray & file_a & ~other_side) << 7) & ~own_side;
-    nw_ray |= ((nw_ray & file_a & ~other_side) << 7) & ~own_side;
-    nw_ray |= ((nw_ray & file_a & ~other_side) << 7) & ~own_side;
-    nw_ray |= ((nw_ray & file_a & ~other_side) << 7) & ~own_side;
-    nw_ray |= ((nw_ray & file_a & ~other_side) << 7) & ~own_side;
+uint64_t magic_rand(uint64_t* seed) {
+    *seed ^= *seed >> 12;
+    *seed ^= *seed << 25;
+    *seed ^= *seed >> 27;
+    return *seed * 0x2545F4914F6CDD1D;
+}
 
-    if (!(nw_ray & piece)) nw_ray = 0;
+enum { SLIDER_MAGIC, SLIDER_PEXT };
+int slider_backend = SLIDER_MAGIC;
 
-    return ne_ray | se_ray | sw_ray | nw_ray;
+/*
+ * Parallel bit extract. Written as inline asm rather than _pext_u64 so it can
+ * be inlined into code compiled without -mbmi2; only reached once
+ * cpu_has_bmi2() has confirmed the instruction exists.
+*/
+uint64_t pext(uint64_t src, uint64_t mask) {
+#if defined(__x86_64__) && defined(__GNUC__)
+    uint64_t dst;
+    __asm__("pextq %2, %1, %0" : "=r" (dst) : "r" (src), "r" (mask));
+    return dst;
+#else
+    return 0;
+#endif
 }
 
-uint64_t bishop_move_board(uint64_t bishop, uint64_t own_side, uint64_t other_side) {
-    uint64_t ne_ray = ((bishop & file_h) << 9) & ~own_side;
-    ne_ray |= ((ne_ray & file_h & ~other_side) << 9) & ~own_side;
-    ne_ray |= ((ne_ray & file_h & ~other_side) << 9) & ~own_side;
-    ne_ray |= ((ne_ray & file_h & ~other_side) << 9) & ~own_side;
-    ne_ray |= ((ne_ray & file_h & ~other_side) << 9) & ~own_side;
-    ne_ray |= ((ne_ray & file_h & ~other_side) << 9) & ~own_side;
-    ne_ray |= ((ne_ray & file_h & ~other_side) << 9) & ~own_side;
-
-    uint64_t se_ray = ((bishop & file_h) >> 7) & ~own_side;
-    se_ray |= ((se_ray & file_h & ~other_side) >> 7) & ~own_side;
-    se_ray |= ((se_ray & file_h & ~other_side) >> 7) & ~own_side;
-    se_ray |= ((se_ray & file_h & ~other_side) >> 7) & ~own_side;
-    se_ray |= ((se_ray & file_h & ~other_side) >> 7) & ~own_side;
-    se_ray |= ((se_ray & file_h & ~other_side) >> 7) & ~own_side;
-    se_ray |= ((se_ray & file_h & ~other_side) >> 7) & ~own_side;
-
-    uint64_t sw_ray = ((bishop & file_a) >> 9) & ~own_side;
-    sw_ray |= ((sw_ray & file_a & ~other_side) >> 9) & ~own_side;
-    sw_ray |= ((sw_ray & file_a & ~other_side) >> 9) & ~own_side;
-    sw_ray |= ((sw_ray & file_a & ~other_side) >> 9) & ~own_side;
-    sw_ray |= ((sw_ray & file_a & ~other_side) >> 9) & ~own_side;
-    sw_ray |= ((sw_ray & file_a & ~other_side) >> 9) & ~own_side;
-    sw_ray |= ((sw_ray & file_a & ~other_side) >> 9) & ~own_side;
-
-    uint64_t nw_ray = ((bishop & file_a) << 7) & ~own_side;
-    nw_ray |= ((nw_ray & file_a & ~other_side) << 7) & ~own_side;
-    nw_ray |= ((nw_ray & file_a & ~other_side) << 7) & ~own_side;
-    nw_ray |= ((nw_ray & file_a & ~other_side) << 7) & ~own_side;
-    nw_ray |= ((nw_ray & file_a & ~other_side) << 7) & ~own_side;
-    nw_ray |= ((nw_ray & file_a & ~other_side) << 7) & ~own_side;
-    nw_ray |= ((nw_ray & file_a & ~other_side) << 7) & ~own_side;
-
-    return ne_ray | se_ray | sw_ray | nw_ray;
+int cpu_has_bmi2() {
+#if defined(__x86_64__) && defined(__GNUC__)
+    return __builtin_cpu_supports("bmi2");
+#else
+    return 0;
+#endif
 }
 
-uint64_t queen_move_board(uint64_t queen, uint64_t own_side, uint64_t other_side) {
-    return bishop_move_board(queen, own_side, other_side) | rook_move_board(queen, own_side, other_side);
+unsigned slider_index(magic* m, uint64_t occupied) {
+    if (slider_backend == SLIDER_PEXT) {
+        return (unsigned) pext(occupied, m->mask);
+    }
+    return (unsigned) (((occupied & m->mask) * m->magic) >> m->shift);
 }
 
-uint64_t queen_attacks_to_piece(uint64_t queen, uint64_t own_side, uint64_t other_side, uint64_t piece) {
-    return bishop_attacks_to_piece(queen, own_side, other_side, piece) | rook_attacks_to_piece(queen, own_side, other_side, piece);
-}
+/*
+ * Fills every square's slice of the attack table for the current backend.
+ * Every subset of the blocker mask is enumerated. With PEXT each subset maps
+ * straight to its index; otherwise a magic is searched for and a candidate
+ * is rejected as soon as two subsets with different attacks share an index.
+*/
+void init_magics(magic* magics, uint64_t* table, int dirs[][2]) {
+    static uint64_t occupancy[4096];
+    static uint64_t reference[4096];
+    static int epoch[4096];
+    static int attempt = 0;
+    uint64_t* attacks = table;
+
+    for (int sq = 0; sq < 64; sq++) {
+        magic* m = &magics[sq];
+        // Edge squares never block further travel so are left out of the mask.
+        uint64_t rank_edges = 0xFF000000000000FF & ~(0xFFULL << (sq / 8 * 8));
+        uint64_t file_edges = 0x8181818181818181 & ~(0x0101010101010101ULL << (sq % 8));
+        m->mask = sliding_attacks(sq, 0, dirs) & ~(rank_edges | file_edges);
+        m->shift = 64 - __builtin_popcountll(m->mask);
+        m->attacks = attacks;
+
+        // Carry rippler enumerates every subset of the mask.
+        int size = 0;
+        uint64_t sub = 0;
+        do {
+            occupancy[size] = sub;
+            reference[size] = sliding_attacks(sq, sub, dirs);
+            size++;
+            sub = (sub - m->mask) & m->mask;
+        } while (sub);
+
+        if (slider_backend == SLIDER_PEXT) {
+            for (int i = 0; i < size; i++) {
+                m->attacks[slider_index(m, occupancy[i])] = reference[i];
+            }
+            attacks += size;
+            continue;
+        }
 
-uint64_t b_move_board(board *b) {
-    uint64_t pawn_moves = pawn_b_move_board(b->pawn_b, b->white, b->black);
-    // For en_passant capture, add target space to white to use as possible attack move for 
-    if (b->en_passant) {
-        pawn_moves |= pawn_b_move_board(b->pawn_b, b->en_passant_target | b->white, b->black);
+        uint64_t seed = magic_seeds[sq / 8];
+        int found = 0;
+        while (!found) {
+            do {
+                m->magic = magic_rand(&seed) & magic_rand(&seed) & magic_rand(&seed);
+            } while (__builtin_popcountll((m->mask * m->magic) >> 56) < 6);
+
+            attempt++;
+            found = 1;
+            for (int i = 0; i < size; i++) {
+                unsigned idx = slider_index(m, occupancy[i]);
+                if (epoch[idx] < attempt) {
+                    epoch[idx] = attempt;
+                    m->attacks[idx] = reference[i];
+                } else if (m->attacks[idx] != reference[i]) {
+                    found = 0;
+                    break;
+                }
+            }
+        }
+        attacks += size;
     }
-    uint64_t queen_moves = queen_move_board(b->queen_b, b->black, b->white);
-    uint64_t king_moves = king_move_board(b->king_b, b->black, b->white);
-    uint64_t rook_moves = rook_move_board(b->rook_b, b->black, b->white);
-    uint64_t knight_moves = knight_move_board(b->knight_b, b->black);
-    uint64_t bishop_moves = bishop_move_board(b->bishop_b, b->black, b->white);
+}
 
-    return pawn_moves | queen_moves | king_moves | rook_moves | knight_moves | bishop_moves;
+/*
+ * Switches slider lookups to the given backend and rebuilds the tables for it.
+ * Not safe to call while another thread is generating moves.
+*/
+void set_slider_backend(int backend) {
+    slider_backend = (backend == SLIDER_PEXT && cpu_has_bmi2()) ? SLIDER_PEXT : SLIDER_MAGIC;
+    init_magics(rook_magics, rook_table, &ray_dirs[NORTH]);
+    init_magics(bishop_magics, bishop_table, &ray_dirs[NORTH_EAST]);
 }
 
-uint64_t w_move_board(board *b) {
-    uint64_t pawn_moves = pawn_w_move_board(b->pawn_w, b->white, b->black);
-    if (b->en_passant) {
-        pawn_moves |= pawn_w_move_board(b->pawn_w, b->white, b->black | b->en_passant_target);
+/*
+ * Fills all precomputed lookup tables. Must be called once at startup
+ * before any move generation.
+*/
+void init_tables() {
+    for (int sq = 0; sq < 64; sq++) {
+        for (int dir = NORTH; dir <= NORTH_WEST; dir++) {
+            rays[dir][sq] = ray_attacks(sq, 0, ray_dirs[dir]);
+        }
+    }
+    for (int sq = 0; sq < 64; sq++) {
+        for (int dir = NORTH; dir <= NORTH_WEST; dir++) {
+            uint64_t targets = rays[dir][sq];
+            while (targets) {
+                int target = pop_lsb(&targets);
+                between[sq][target] = rays[dir][sq] & ~rays[dir][target] & ~((uint64_t) 1 << target);
+                line[sq][target] = rays[dir][sq] | rays[opposite_dir[dir]][sq] | ((uint64_t) 1 << sq);
+            }
+        }
     }
-    uint64_t queen_moves = queen_move_board(b->queen_w, b->white, b->black);
-    uint64_t king_moves = king_move_board(b->king_w, b->white, b->black);
-    uint64_t rook_moves = rook_move_board(b->rook_w, b->white, b->black);
-    uint64_t knight_moves = knight_move_board(b->knight_w, b->white);
-    uint64_t bishop_moves = bishop_move_board(b->bishop_w, b->white, b->black);
+    init_step_attacks();
+    set_slider_backend(cpu_has_bmi2() ? SLIDER_PEXT : SLIDER_MAGIC);
+    init_zobrist();
+    init_eval();
+    init_pawn_masks();
+    init_search();
+}
 
-    return pawn_moves | queen_moves | king_moves | rook_moves | knight_moves | bishop_moves;
+uint64_t rook_attacks(int sq, uint64_t occupied) {
+    magic* m = &rook_magics[sq];
+    return m->attacks[slider_index(m, occupied)];
 }
 
-/* 
- * Returns all possible attacks by black pieces.
-*/
-uint64_t attack_board_b(board* b) {
-    return b_move_board(b) & b->white;
+uint64_t bishop_attacks(int sq, uint64_t occupied) {
+    magic* m = &bishop_magics[sq];
+    return m->attacks[slider_index(m, occupied)];
 }
 
-/* 
- * Returns all possible attacks by white pieces.
-*/
-uint64_t attack_board_w(board* b) {
-    return w_move_board(b) & b->black;
+uint64_t rook_move_board(uint64_t rook, uint64_t own_side, uint64_t other_side) {
+    uint64_t occupied = own_side | other_side;
+    uint64_t moves = 0;
+    while (rook) {
+        moves |= rook_attacks(pop_lsb(&rook), occupied);
+    }
+    return moves & ~own_side;
 }
 
 /*
- * Returns true if current piece is being attacked. 
+ * Returns only the rook rays which reach piece, ie. the attack paths to piece.
 */
-int is_attacked_w(uint64_t piece_w, board* b) {
-    return (attack_board_b(b) & piece_w) ? 1: 0; 
+uint64_t rook_attacks_to_piece(uint64_t rook, uint64_t own_side, uint64_t other_side, uint64_t piece) {
+    uint64_t occupied = own_side | other_side;
+    uint64_t paths = 0;
+    while (rook) {
+        int sq = pop_lsb(&rook);
+        uint64_t attacks = rook_attacks(sq, occupied) & ~own_side;
+        for (int dir = NORTH; dir <= WEST; dir++) {
+            uint64_t ray = attacks & rays[dir][sq];
+            if (ray & piece) paths |= ray;
+        }
+    }
+    return paths;
 }
 
 /*
- * Returns true if current piece is being attacked. 
+ * Returns only the bishop rays which reach piece, ie. the attack paths to piece.
 */
-int is_attacked_b(uint64_t piece_b, board* b) {
-    return (attack_board_w(b) & piece_b) ? 1: 0; 
+uint64_t bishop_attacks_to_piece(uint64_t bishop, uint64_t own_side, uint64_t other_side, uint64_t piece) {
+    uint64_t occupied = own_side | other_side;
+    uint64_t paths = 0;
+    while (bishop) {
+        int sq = pop_lsb(&bishop);
+        uint64_t attacks = bishop_attacks(sq, occupied) & ~own_side;
+        for (int dir = NORTH_EAST; dir <= NORTH_WEST; dir++) {
+            uint64_t ray = attacks & rays[dir][sq];
+            if (ray & piece) paths |= ray;
+        }
+    }
+    return paths;
 }
 
-int in_check_w(board* b) {
-    return is_attacked_w(b->king_w, b);    
+uint64_t bishop_move_board(uint64_t bishop, uint64_t own_side, uint64_t other_side) {
+    uint64_t occupied = own_side | other_side;
+    uint64_t moves = 0;
+    while (bishop) {
+        moves |= bishop_attacks(pop_lsb(&bishop), occupied);
+    }
+    return moves & ~own_side;
 }
 
-int in_check_b(board* b) {
-    return is_attacked_b(b->king_b, b);    
+uint64_t queen_move_board(uint64_t queen, uint64_t own_side, uint64_t other_side) {
+    uint64_t occupied = own_side | other_side;
+    uint64_t moves = 0;
+    while (queen) {
+        int sq = pop_lsb(&queen);
+        moves |= rook_attacks(sq, occupied) | bishop_attacks(sq, occupied);
+    }
+    return moves & ~own_side;
 }
 
-int in_check(board* b, int side) {
-    return (side) ? in_check_w(b): in_check_b(b);
+uint64_t queen_attacks_to_piece(uint64_t queen, uint64_t own_side, uint64_t other_side, uint64_t piece) {
+    return bishop_attacks_to_piece(queen, own_side, other_side, piece) | rook_attacks_to_piece(queen, own_side, other_side, piece);
 }
 
+/*
+ * Returns every square the pieces of side could move to, including an en 
+ * passant capture, ignoring pins and checks.
+*/
+uint64_t side_move_board(board* b, int side) {
+    uint64_t own = b->colors[side];
+    uint64_t opp = b->colors[!side];
+    uint64_t pawns = piece_board(b, side, PAWN);
+    // For en passant capture, add the target square to the other side as a possible attack.
+    uint64_t pawn_moves = pawn_move_board(pawns, own, opp | en_passant_target(b), side);
+    uint64_t queen_moves = queen_move_board(piece_board(b, side, QUEEN), own, opp);
+    uint64_t king_moves = king_move_board(piece_board(b, side, KING), own, opp);
+    uint64_t rook_moves = rook_move_board(piece_board(b, side, ROOK), own, opp);
+    uint64_t knight_moves = knight_move_board(piece_board(b, side, KNIGHT), own);
+    uint64_t bishop_moves = bishop_move_board(piece_board(b, side, BISHOP), own, opp);
 
-board* board_copy(board *new_board, board* b) {
-    new_board->pawn_w = b->pawn_w;
-    new_board->queen_w = b->queen_w;
-    new_board->king_w = b->king_w;
-    new_board->rook_w = b->rook_w;
-    new_board->knight_w = b->knight_w;
-    new_board->bishop_w = b->bishop_w;
-    new_board->pawn_b = b->pawn_b;
-    new_board->queen_b = b->queen_b;
-    new_board->king_b = b->king_b;
-    new_board->rook_b = b->rook_b;
-    new_board->knight_b = b->knight_b;
-    new_board->bishop_b = b->bishop_b;
-    set_sides(new_board);
-    new_board->castle_w_l = b->castle_w_l;
-    new_board->castle_w_r = b->castle_w_r;
-    new_board->castle_b_l = b->castle_b_l;
-    new_board->castle_b_r = b->castle_b_r;
-
-    new_board->turn = b->turn;
-    return new_board;
-}
-
-void get_intersecting_w(board *b, uint64_t spaces) {
-    b->pawn_w &= spaces;
-    b->queen_w &= spaces;
-    b->king_w &= spaces;
-    b->rook_w &= spaces;
-    b->knight_w &= spaces;
-    b->bishop_w &= spaces;
-    b->white &= spaces;
-}
-
-void get_intersecting_b(board *b, uint64_t spaces) {
-    b->pawn_b &= spaces;
-    b->queen_b &= spaces;
-    b->king_b &= spaces;
-    b->rook_b &= spaces;
-    b->knight_b &= spaces;
-    b->bishop_b &= spaces;
-    b->black &= spaces;
-}
-
-uint64_t w_legal_moves(board* b) {
-    // Determine if in check and return only moves that escape check. 
-    uint64_t black_moves = b_move_board(b);
-
-    // In check
-    if (black_moves & b->king_w) {
-        uint64_t moves = 0;
-        // Remove king from psuedo legal. Will generate separately at end.
-        uint64_t king = b->king_w;
-        b->king_w = 0;
-        uint64_t psuedo_legal_moves = w_move_board(b);
-        b->king_w = king;
-        uint64_t rook_attacks_to_king = rook_attacks_to_piece(b->rook_b | b->queen_b, b->black, b->white, b->king_w);
-        uint64_t bishop_attacks_to_king = bishop_attacks_to_piece(b->bishop_b | b->queen_b, b->black, b->white, b->king_w);
-        uint64_t attack_paths_to_king = rook_attacks_to_king | bishop_attacks_to_king; 
-        // Find interpositions
-        if (attack_paths_to_king) {
-            moves |= (psuedo_legal_moves & attack_paths_to_king);
-        }
-        // Compute capture moves.
-        moves |= psuedo_legal_moves & pawn_w_move_board(b->king_w, b->white, b->black) & b->pawn_b;
-        moves |= psuedo_legal_moves & bishop_move_board(b->king_w, b->white, b->black) & (b->bishop_b | b->queen_b);
-        moves |= psuedo_legal_moves & knight_move_board(b->king_w, b->white) & b->knight_b;
-        moves |= psuedo_legal_moves & rook_move_board(b->king_w, b->white, b->black) & (b->rook_b | b->queen_b);
-        // Compute king moves. Add unchecked king moves as "white" pieces to remove moves still being attacked.
-        uint64_t king_moves = king_move_board(b->king_w, b->white, b->black);
-        uint64_t white_side = b->white;
-        b->white |= king_moves;
-        black_moves = b_move_board(b);
-        moves |= (king_moves & ~black_moves);
-        b->white = white_side;
-        return moves;
-    }
-    // First generate moves of pinned pieces, ie pieces limited by placing king in check
-    uint64_t attacks_to_king = queen_move_board(b->king_w, b->black, b->white);
-    // Board with potentially pinned pieces ie pieces in possible rook attack path to king.
-    board *b_pinned = board_alloc();
-    board_copy(b_pinned, b);
-    get_intersecting_w(b_pinned, attacks_to_king);
-    // Compute new board without pinned pieces by finding intersection of board and the flip of all pinned pieces. 
-    board* b_unpinned = board_alloc();
-    board_copy(b_unpinned, b);
-    get_intersecting_w(b_unpinned, ~(b_pinned->white));
-    // Now compute queen attacks from king square against enemy side to find pinners.
-    attacks_to_king = queen_move_board(b->king_w, b_unpinned->white, b_unpinned->black);
-    // Find all enemy, black, pinning pieces by finding black intersection with queen attacks from king
-    board* b_pinners = board_alloc();
-    board_copy(b_pinners, b);
-    get_intersecting_b(b_pinners, attacks_to_king);
-    uint64_t pinners = b_pinners->rook_b | b_pinners->bishop_b | b_pinners->queen_b;
-    // Rook attacks are actual rooks and horizontal / vertical attacks of queen
-    uint64_t rook_pinner_attacks = rook_move_board(b_pinners->rook_b | b_pinners->queen_b, b_pinners->black, b_pinners->white);
-    // Bishop attacks are actual bishop attacks and diagonal attacks of queen
-    uint64_t bishop_pinner_attacks = bishop_move_board(b_pinners->bishop_b | b_pinners->queen_b, b_pinners->black, b_pinners->white);
-    // Intersect pinner_attacks with pinned pieces to find actually pinned pieces.
-    uint64_t pinner_attacks = rook_pinner_attacks | bishop_pinner_attacks;
-    get_intersecting_w(b_pinned, pinner_attacks);
-    uint64_t pinned_piece_moves = w_move_board(b_pinned);
-    // Intersect with pinner_attacks and pinners to find moves which capture pinner or move along attacking path.
-    pinned_piece_moves &= (pinner_attacks | pinners); 
-    // Find board of actually unpinned pieces by intersecting with flip of all pinners 
-    board_copy(b_unpinned, b);
-    // Remove pinned pieces themselves but leave them in white to preserve blocks / obstructions
-    uint64_t unpinned_white = b_unpinned->white;
-    get_intersecting_w(b_unpinned, ~(b_pinned->white));
-    b_unpinned->white = unpinned_white;
-    // Unpinned piece moves masked with all moves to remove extraneous moves generated by removing pinned pieces ie. extra castle paths.
-    uint64_t king = b_unpinned->king_w;
-    b_unpinned->king_w = 0;
-    uint64_t unpinned_piece_moves = w_move_board(b_unpinned);
-    b_unpinned->king_w = king;
-    // Remove all king moves that place it in check.
-    uint64_t king_moves = king_move_board(b->king_w, b->white, b->black);
-    uint64_t white_side = b->white;
-    b->white |= king_moves;
-    // Compute black captures with king moves as "pieces" to account for attack squares.
-    black_moves = b_move_board(b);
-    // Mask with flip of black moves to remove any king moves into black move squares.
-    unpinned_piece_moves |= (king_moves & ~black_moves);
-    b->white = white_side;
-    board_delete(b_pinned);
-    board_delete(b_unpinned);
-    board_delete(b_pinners);
-
-    return pinned_piece_moves | unpinned_piece_moves;
-}
-
-uint64_t b_legal_moves(board* b) {
-    uint64_t white_moves = w_move_board(b);
-
-    // In check
-    if (white_moves & b->king_b) {
-        uint64_t moves = 0;
-        // Remove king from psuedo legal. Will generate separately at end.
-        uint64_t king = b->king_b;
-        b->king_b = 0;
-        uint64_t psuedo_legal_moves = b_move_board(b);
-        b->king_b = king;
-        uint64_t rook_attacks_to_king = rook_attacks_to_piece(b->rook_w | b->queen_w, b->white, b->black, b->king_b);
-        uint64_t bishop_attacks_to_king = bishop_attacks_to_piece(b->bishop_w | b->queen_w, b->white, b->black, b->king_b);
-        uint64_t attack_paths_to_king = rook_attacks_to_king | bishop_attacks_to_king; 
-        // Find interpositions
-        if (attack_paths_to_king) {
-            moves |= (psuedo_legal_moves & attack_paths_to_king);
-        }
-        // Compute capture moves.
-        moves |= psuedo_legal_moves & pawn_b_move_board(b->king_b, b->white, b->black) & b->pawn_w;
-        moves |= psuedo_legal_moves & bishop_move_board(b->king_b, b->black, b->white) & (b->bishop_w | b->queen_w);
-        moves |= psuedo_legal_moves & knight_move_board(b->king_b, b->black) & b->knight_w;
-        moves |= psuedo_legal_moves & rook_move_board(b->king_b, b->black, b->white) & (b->rook_w | b->queen_w);
-        uint64_t king_moves = king_move_board(b->king_b, b->black, b->white);
-        // Compute king moves. Add unchecked king moves as "black" pieces to remove moves still being attacked.
-        uint64_t black_side = b->black;
-        b->black |= king_moves;
-        white_moves = w_move_board(b);
-        moves |= (king_moves & ~white_moves);
-        b->black = black_side;
-        return moves;
-
-    }
-    // First generate moves of pinned pieces, ie pieces limited by placing king in check
-    uint64_t attacks_to_king = queen_move_board(b->king_b, b->white, b->black);
-    // Board with potentially pinned pieces ie pieces in possible rook attack path to king.
-    board *b_pinned = board_alloc();
-    board_copy(b_pinned, b);
-    get_intersecting_b(b_pinned, attacks_to_king);
-    // Compute new board without pinned pieces by finding intersection of board and the flip of all pinned pieces. 
-    board* b_unpinned = board_alloc();
-    board_copy(b_unpinned, b);
-    get_intersecting_b(b_unpinned, ~(b_pinned->black));
-    // Re-compute rook attacks with new board.
-    attacks_to_king = queen_move_board(b->king_b, b_unpinned->black, b_unpinned->white);
-    
-    // Find all enemy, black, pinning pieces by finding black intersection with queen attacks from king
-    board* b_pinners = board_alloc();
-    board_copy(b_pinners, b);
-    get_intersecting_w(b_pinners, attacks_to_king);
-    uint64_t pinners = b_pinners->rook_w | b_pinners->bishop_w | b_pinners->queen_w;
-    // Rook attacks are actual rooks and horizontal / vertical attacks of queen
-    uint64_t rook_pinner_attacks = rook_move_board(b_pinners->rook_w | b_pinners->queen_w, b_pinners->white, b_pinners->black);
-    // Bishop attacks are actual bishop attacks and diagonal attacks of queen
-    uint64_t bishop_pinner_attacks = bishop_move_board(b_pinners->bishop_w | b_pinners->queen_w, b_pinners->white, b_pinners->black);
-    // Intersect pinner_attacks with pinned pieces to find actually pinned pieces.
-    uint64_t pinner_attacks = rook_pinner_attacks | bishop_pinner_attacks;
-    get_intersecting_b(b_pinned, pinner_attacks);
-    uint64_t pinned_piece_moves = b_move_board(b_pinned);
-    // Intersect with pinner_attacks and pinners to find moves which capture pinner or move along attacking path.
-    pinned_piece_moves &= (pinner_attacks | pinners); 
-    // Find board of actually unpinned pieces by intersecting with flip of all pinners 
-    board_copy(b_unpinned, b);
-    uint64_t unpinned_black = b_unpinned->black;
-    uint64_t king = b_unpinned->king_b;
-    get_intersecting_b(b_unpinned, ~(b_pinned->black));
-    b_unpinned->black = unpinned_black;
-    b_unpinned->king_b = 0;
-    uint64_t unpinned_piece_moves = b_move_board(b_unpinned);
-    b_unpinned->king_b = king;
-    // Remove all king moves that place it in check.
-    uint64_t king_moves = king_move_board(b->king_b, b->black, b->white);
-    uint64_t black_side = b->black;
-    b->black |= king_moves;
-    // Compute white captures with king moves as "pieces" to account for attack squares.
-    white_moves = w_move_board(b);
-    // Mask with flip of white moves to remove any king moves into white move squares.
-    unpinned_piece_moves |= (king_moves & ~white_moves);
-    b->black = black_side;
-    board_delete(b_pinned);
-    board_delete(b_unpinned);
-    board_delete(b_pinners);
-
-    return pinned_piece_moves | unpinned_piece_moves;
+    return pawn_moves | queen_moves | king_moves | rook_moves | knight_moves | bishop_moves;
 }
 
-uint64_t get_legal_moves(board *b) {
-    return (b->turn) ? w_legal_moves(b): b_legal_moves(b);
+/* 
+ * Returns all pieces of the other side that side attacks.
+*/
+uint64_t attack_board(board* b, int side) {
+    return side_move_board(b, side) & b->colors[!side];
 }
 
-uint64_t move_board_w(board* b, uint64_t piece) {
-    uint64_t pawn = b->pawn_w & piece;
-    uint64_t queen = b->queen_w & piece;
-    uint64_t king = b->king_w & piece;
-    uint64_t rook = b->rook_w & piece;
-    uint64_t knight = b->knight_w & piece;
-    uint64_t bishop = b->bishop_w & piece;
-    
-    if (pawn) {
-        return pawn_w_move_board(piece, b->white, b->black);
-    } else if (queen) {
-        return queen_move_board(piece, b->white, b->black);
-    } else if (king) {
-        // Remove king moves into attacked squares
-        uint64_t king_moves = king_move_board(piece, b->white, b->black);
-        uint64_t white = b->white;
-        b->white |= king_moves;
-        king_moves &= ~(b_move_board(b));
-        b->white = white;
-        return king_moves;
-    } else if (rook) {
-        return rook_move_board(piece, b->white, b->black);
-    } else if (knight) {
-        return knight_move_board(piece, b->white);
-    } else if (bishop) {
-        return bishop_move_board(piece, b->white, b->black);
-    }
-    return 0;
+/*
+ * Returns true if piece, belonging to side, is being attacked. 
+*/
+int is_attacked(board* b, uint64_t piece, int side) {
+    return (attack_board(b, !side) & piece) ? 1: 0; 
 }
 
-uint64_t move_board_b(board* b, uint64_t piece) {
-    uint64_t pawn = b->pawn_b & piece;
-    uint64_t queen = b->queen_b & piece;
-    uint64_t king = b->king_b & piece;
-    uint64_t rook = b->rook_b & piece;
-    uint64_t knight = b->knight_b & piece;
-    uint64_t bishop = b->bishop_b & piece;
-    
-    if (pawn) {
-        return pawn_b_move_board(piece, b->white, b->black);
-    } else if (queen) {
-        return queen_move_board(piece, b->black, b->white);
-    } else if (king) {
-        // Remove king moves into attacked squares
-        uint64_t king_moves = king_move_board(piece, b->black, b->white);
-        uint64_t black = b->black;
-        b->black |= king_moves;
-        king_moves &= ~(b_move_board(b));
-        b->black = black;
-        return king_moves;
-    } else if (rook) {
-        return rook_move_board(piece, b->black, b->white);
-    } else if (knight) {
-        return knight_move_board(piece, b->black);
-    } else if (bishop) {
-        return bishop_move_board(piece, b->black, b->white);
-    }
-    return 0;
+int in_check(board* b, int side) {
+    int king_sq = __builtin_ctzll(piece_board(b, side, KING));
+    return side_attackers_to(b, king_sq, b->colors[WHITE] | b->colors[BLACK], !side) != 0;
 }
 
-uint64_t move_board(board* b, uint64_t piece) {
-    return (b->turn) ? move_board_w(b, piece): move_board_b(b, piece);
+/*
+ * Copies b into new_board. The board holds no pointers so this is a plain 
+ * struct copy.
+*/
+board* board_copy(board *new_board, board* b) {
+    *new_board = *b;
+    return new_board;
 }
 
-/* 
- * Updates move location in given board. 
- * from: single bit location being moved, to is destination bit location.
- * board: board to be updated 
+/*
+ * Returns the squares the piece of the side to move on single bit location 
+ * piece could move to. King moves into attacked squares are removed.
 */
-char* make_move_b(uint64_t from, uint64_t to, board* b) {
-    uint64_t pawn = b->pawn_b & from;
-    uint64_t queen = b->queen_b & from;
-    uint64_t king = b->king_b & from;
-    uint64_t rook = b->rook_b & from;
-    uint64_t knight = b->knight_b & from;
-    uint64_t bishop = b->bishop_b & from;
-    char* move_str = malloc(4 * sizeof(char));
-    char* alg_str = malloc(3 * sizeof(char));
-    
-    if (pawn) {
-        b->pawn_b &= ~from;
-        b->pawn_b |= to;
-        // If pawn moving two spaces set en passant boolean. 
-        if ((from & ~rank_7) && (to & rank_5)) {
-            b->en_passant = 1;
-            b->en_passant_target = (from >> 8); 
+uint64_t move_board(board* b, uint64_t piece) {
+    int side = side_to_move(b);
+    uint64_t own = b->colors[side];
+    uint64_t opp = b->colors[!side];
+    switch (piece_on(b, piece, side)) {
+        case PAWN:
+            return pawn_move_board(piece, own, opp, side);
+        case QUEEN:
+            return queen_move_board(piece, own, opp);
+        case KING: {
+            uint64_t king_moves = king_move_board(piece, own, opp);
+            b->colors[side] |= king_moves;
+            king_moves &= ~side_move_board(b, !side);
+            b->colors[side] = own;
+            return king_moves;
         }
-        bit_pos_to_alg(to, alg_str);
-        snprintf(move_str, 2 * sizeof(char), "p");
-        strncat(move_str, alg_str, 2);
-    } else if (queen) {
-        b->queen_b &= ~from;
-        b->queen_b |= to;
-        bit_pos_to_alg(to, alg_str);
-        snprintf(move_str, 2 * sizeof(char), "q");
-        strncat(move_str, alg_str, 2);
-    } else if (king) {
-        b->king_b &= ~from;
-        b->king_b |= to;
-        b->castle_b_l = 0;
-        b->castle_b_r = 0;
-        bit_pos_to_alg(to, alg_str);
-        snprintf(move_str, 2 * sizeof(char), "k");
-        strncat(move_str, alg_str, 2);
-    } else if (rook) {
-        b->rook_b &= ~from;
-        b->rook_b |= to;
-        b->castle_b_l = 0;
-        b->castle_b_r = 0;
-        bit_pos_to_alg(to, alg_str);
-        snprintf(move_str, 2 * sizeof(char), "r");
-        strncat(move_str, alg_str, 2);
-    } else if (knight) {
-        b->knight_b &= ~from;
-        b->knight_b |= to;
-        bit_pos_to_alg(to, alg_str);
-        snprintf(move_str, 2 * sizeof(char), "n");
-        strncat(move_str, alg_str, 2);
-    } else if (bishop) {
-        b->bishop_b &= ~from;
-        b->bishop_b |= to;
-        bit_pos_to_alg(to, alg_str);
-        snprintf(move_str, 2 * sizeof(char), "b");
-        strncat(move_str, alg_str, 2);
-    }
-
-    b->black &= ~from;
-    b->black |= to;
-
-    if (b->white & to) {
-        make_move_w(to, 0, b);
-    }
-
-    free(alg_str);
-    return move_str;
+        case ROOK:
+            return rook_move_board(piece, own, opp);
+        case KNIGHT:
+            return knight_move_board(piece, own);
+        case BISHOP:
+            return bishop_move_board(piece, own, opp);
+    }
+    return 0;
 }
 
 int bit_pos_to_int(uint64_t pos) {
@@ -924,518 +793,2657 @@ int bit_pos_to_int(uint64_t pos) {
     return val;
 }
 
+/*
+ * Writes the name of single bit location pos, eg. e4, into pos_str which must hold 3 chars.
+*/
 void bit_pos_to_alg(uint64_t pos, char* pos_str) {
-    if (pos & ~file_a) {
-        snprintf(pos_str, 2 * sizeof(char), "a");
-    } else if (pos & ~file_b) {
-        snprintf(pos_str, 2 * sizeof(char), "b");
-    } else if (pos & ~file_c) {
-        snprintf(pos_str, 2 * sizeof(char), "c");
-    } else if (pos & ~file_d) {
-        snprintf(pos_str, 2 * sizeof(char), "d");
-    } else if (pos & ~file_e) {
-        snprintf(pos_str, 2 * sizeof(char), "e");
-    } else if (pos & ~file_f) {
-        snprintf(pos_str, 2 * sizeof(char), "f");
-    } else if (pos & ~file_g) {
-        snprintf(pos_str, 2 * sizeof(char), "g");
-    } else if (pos & ~file_h) {
-        snprintf(pos_str, 2 * sizeof(char), "h");
-    }
-
-    if (pos & ~rank_1) {
-        strncat(pos_str, "1", 1);
-    } else if (pos & ~rank_2) {
-        strncat(pos_str, "2", 1);
-    } else if (pos & ~rank_3) {
-        strncat(pos_str, "3", 1);
-    } else if (pos & ~rank_4) {
-        strncat(pos_str, "4", 1);
-    } else if (pos & ~rank_5) {
-        strncat(pos_str, "5", 1);
-    } else if (pos & ~rank_6) {
-        strncat(pos_str, "6", 1);
-    } else if (pos & ~rank_7) {
-        strncat(pos_str, "7", 1);
-    } else if (pos & ~rank_8) {
-        strncat(pos_str, "8", 1);
-    }
+    int sq = __builtin_ctzll(pos);
+    pos_str[0] = file_names[sq % 8];
+    pos_str[1] = rank_names[sq / 8];
+    pos_str[2] = '\0';
 }
 
 /* 
  * Updates move location in given board. 
- * from: single bit location being moved, to is destination bit location.
+ * from: single bit location being moved, to is destination bit location, 
+ * or 0 to take the piece off the board.
  * board: board to be updated 
+ * side: side the moving piece belongs to
+ * Returns the piece moved, NO_PIECE if side has no piece on from. 
 */
-char* make_move_w(uint64_t from, uint64_t to, board* b) {
-    uint64_t pawn = b->pawn_w & from;
-    uint64_t queen = b->queen_w & from;
-    uint64_t king = b->king_w & from;
-    uint64_t rook = b->rook_w & from;
-    uint64_t knight = b->knight_w & from;
-    uint64_t bishop = b->bishop_w & from;
-    char* move_str = malloc(4 * sizeof(char));
-    char* alg_str = malloc(3 * sizeof(char));
-    
-    if (pawn) {
-        b->pawn_w &= ~from;
-        b->pawn_w |= to;
-        if ((from & ~rank_2) && (to & rank_4)) {
-            b->en_passant = 1;
-            b->en_passant_target = (from << 8);
-        }
-        bit_pos_to_alg(to, alg_str);
-        snprintf(move_str, 2 * sizeof(char), "P");
-        strncat(move_str, alg_str, 2);
-    } else if (queen) {
-        b->queen_w &= ~from;
-        b->queen_w |= to;
-        bit_pos_to_alg(to, alg_str);
-        snprintf(move_str, 2 * sizeof(char), "Q");
-        strncat(move_str, alg_str, 2);
-    } else if (king) {
-        b->king_w &= ~from;
-        b->king_w |= to;
-        b->castle_w_l = 0;
-        b->castle_w_r = 0;
-        bit_pos_to_alg(to, alg_str);
-        snprintf(move_str, 2 * sizeof(char), "K");
-        strncat(move_str, alg_str, 2);
-    } else if (rook) {
-        b->rook_w &= ~from;
-        b->rook_w |= to;
-        b->castle_w_l = 0;
-        b->castle_w_r = 0;
-        bit_pos_to_alg(to, alg_str);
-        snprintf(move_str, 2 * sizeof(char), "R");
-        strncat(move_str, alg_str, 2);
-    } else if (knight) {
-        b->knight_w &= ~from;
-        b->knight_w |= to;
-        bit_pos_to_alg(to, alg_str);
-        snprintf(move_str, 2 * sizeof(char), "N");
-        strncat(move_str, alg_str, 2);
-    } else if (bishop) {
-        b->bishop_w &= ~from;
-        b->bishop_w |= to;
-        bit_pos_to_alg(to, alg_str);
-        snprintf(move_str, 2 * sizeof(char), "B");
-        strncat(move_str, alg_str, 2);
-    }
-    
-    b->white &= ~from;
-    b->white |= to;
+int make_move_side(uint64_t from, uint64_t to, board* b, int side) {
+    int piece = piece_on(b, from, side);
+    if (piece == NO_PIECE) return NO_PIECE;
 
-    if (b->black & to) {
-        make_move_b(to, 0, b);
+    if (b->colors[!side] & to) {
+        make_move_side(to, 0, b, !side);
     }
-    free(alg_str);
-    return move_str;
-
-}
 
+    b->pieces[piece] = (b->pieces[piece] & ~from) | to;
+    b->colors[side] = (b->colors[side] & ~from) | to;
+    set_square_code(b, __builtin_ctzll(from), NO_PIECE);
+    if (to) {
+        set_square_code(b, __builtin_ctzll(to), mailbox_code(side, piece));
+    }
 
-/*
- * Undo move by calling moving in the reverse direction. 
- * Requires castle booleans from board prior to move for reset.
-*/
-void undo_move_b(uint64_t from, uint64_t to, board* b) {
-    make_move_b(to, from, b);
+    uint64_t start = (side) ? ~rank_2: ~rank_7;
+    uint64_t double_push = (side) ? ~rank_4: ~rank_5;
+    if (piece == PAWN && (from & start) && (to & double_push)) {
+        // If pawn moving two spaces set the en passant target behind it.
+        set_en_passant(b, __builtin_ctzll((side) ? from << 8: from >> 8));
+    } else if (piece == KING || piece == ROOK) {
+        int rights = (side) ? CASTLE_W_L | CASTLE_W_R: CASTLE_B_L | CASTLE_B_R;
+        set_castle_rights(b, get_castle_rights(b) & ~rights);
+    }
+    return piece;
 }
 
 /*
- * Undo move by calling moving in the reverse direction. 
+ * Writes piece moved by side to single bit location to, eg. Pe4, into str 
+ * which must hold 4 chars.
 */
-void undo_move_w(uint64_t from, uint64_t to, board* b) {
-    make_move_w(to, from, b);
-}
-
-void undo_move(uint64_t from, uint64_t to, board* b, board* old_board) {
-    board_copy(b, old_board);
+void piece_move_to_str(int side, int piece, uint64_t to, char* str) {
+    str[0] = (piece == NO_PIECE) ? '?': piece_names[side][piece];
+    bit_pos_to_alg(to, str + 1);
 }
 
 void make_move(uint64_t from, uint64_t to, board* b, int print) {
-    // Set en_passant to false to remove last move.
-    b->en_passant = 0;
-    char* move_str = (b->turn) ? make_move_w(from, to, b): make_move_b(from, to, b);
+    int side = side_to_move(b);
+    // Clear en passant to remove last move.
+    set_en_passant(b, 0);
+    int piece = make_move_side(from, to, b, side);
     if (print) {
+        char move_str[4];
+        piece_move_to_str(side, piece, to, move_str);
         printf("%s ", move_str);
     }
-    free(move_str);
-    b->turn = !b->turn;
-}
-
-int make_castle_b_r(board *b) {
-    // King and rook starting positions for w left castle. 
-    // No need to check if king or rook in these positions as booleans verify they haven't been moved.
-    uint64_t king = 0x1000000000000000;
-    uint64_t rook = 0x8000000000000000;
-    uint64_t king_right = 0x2000000000000000;
-    // Check if rook can move to kings left and if no enemy piece ie no obstruction for castling.
-    uint64_t can_castle = rook_move_board(rook, b->white, b->black) & king_right & ~b->black;
-
-    // Move rook and king to correct positions if castle availiable. 
-    if (can_castle) {
-        make_move_w(rook, king_right, b);
-        make_move_w(king, 0x4000000000000000, b);
-        b->turn = 1;
-        return 1;
-    }
-    return 0;
-}
-
-int make_castle_b_l(board *b) {
-    // King and rook starting positions for w left castle. 
-    // No need to check if king or rook in these positions as booleans verify they haven't been moved.
-    uint64_t king = 0x1000000000000000;
-    uint64_t rook = 0x0100000000000000;
-    uint64_t king_left = 0x0800000000000000;
-    // Check if rook can move to kings left and if no enemy piece ie no obstruction for castling.
-    uint64_t can_castle = rook_move_board(rook, b->white, b->black) & king_left & ~b->black;
-
-    // Move rook and king to correct positions if castle availiable. 
-    if (can_castle) {
-        make_move_w(rook, king_left, b);
-        make_move_w(king, 0x0400000000000000, b);
-        b->turn = 1;
-        return 1;
-    }
-    return 0;
-}
-
-int make_castle_w_r(board *b) {
-    // King and rook starting positions for w left castle. 
-    // No need to check if king or rook in these positions as booleans verify they haven't been moved.
-    uint64_t king = 0x10;
-    uint64_t rook = 0x80;
-    uint64_t king_right = 0x20;
-    // Check if rook can move to kings left and if no enemy piece ie no obstruction for castling.
-    uint64_t can_castle = rook_move_board(rook, b->white, b->black) & king_right & ~b->black;
-
-    // Move rook and king to correct positions if castle availiable. 
-    if (can_castle) {
-        make_move_w(rook, king_right, b);
-        make_move_w(king, 0x40, b);
-        b->turn = 0;
-        return 1;
-    }
-    return 0;
-}
-
-int make_castle_w_l(board *b) {
-    // King and rook starting positions for w left castle. 
-    // No need to check if king or rook in these positions as booleans verify they haven't been moved.
-    uint64_t king = 0x10;
-    uint64_t rook = 0x1;
-    uint64_t king_left = 0x8;
-    // Check if rook can move to kings left and if no enemy piece ie no obstruction for castling.
-    uint64_t can_castle = rook_move_board(rook, b->white, b->black) & king_left & ~b->black;
-
-    // Move rook and king to correct positions if castle availiable. 
-    if (can_castle) {
-        make_move_w(rook, king_left, b);
-        make_move_w(king, 0x4, b);
-        b->turn = 0;
-        return 1;
-    }
-    return 0;
+    set_side_to_move(b, !side);
+    // Legacy path does not track key or evaluation changes so recompute them.
+    b->key = compute_key(b);
+    b->pawn_key = compute_pawn_key(b);
+    compute_eval(b);
 }
 
-void undo_castle_b_r(board *b) {
-    uint64_t king = 0x1000000000000000;
-    uint64_t rook = 0x8000000000000000;
-    uint64_t king_right = 0x2000000000000000;
-    uint64_t king_dest = 0x4000000000000000;
-
-    make_move_w(king_right, rook, b);
-    make_move_w(king_dest, king, b);
-    b->turn = 0;
+int can_castle_l(board *b) {
+    return get_castle_rights(b) & ((side_to_move(b)) ? CASTLE_W_L: CASTLE_B_L);
 }
 
-void undo_castle_b_l(board *b) {
-    uint64_t king = 0x1000000000000000;
-    uint64_t rook = 0x0100000000000000;
-    uint64_t king_left = 0x0800000000000000;
-    uint64_t king_dest = 0x0400000000000000;
-
-    make_move_w(king_left, rook, b);
-    make_move_w(king_dest, king, b);
-    b->turn = 0;
+int can_castle_r(board *b) {
+    return get_castle_rights(b) & ((side_to_move(b)) ? CASTLE_W_R: CASTLE_B_R);
 }
 
-void undo_castle_w_r(board *b) {
-    uint64_t king = 0x10;
-    uint64_t rook = 0x80;
-    uint64_t king_right = 0x20;
-    uint64_t king_dest = 0x40;
-
-    make_move_w(king_right, rook, b);
-    make_move_w(king_dest, king, b);
-    b->turn = 1;
+move encode_move(int from, int to, int flags) {
+    return (move) (from | (to << 6) | (flags << 12));
 }
 
-void undo_castle_w_l(board *b) {
-    uint64_t king = 0x10;
-    uint64_t rook = 0x1;
-    uint64_t king_left = 0x8;
-    uint64_t king_dest = 0x4;
-
-    make_move_w(king_left, rook, b);
-    make_move_w(king_dest, king, b);
-    b->turn = 1;
+int move_from(move m) {
+    return m & 0x3F;
 }
 
-int make_castle_l(board *b) {
-    return (b->turn) ? make_castle_w_l(b) : make_castle_b_l(b);
+int move_to(move m) {
+    return (m >> 6) & 0x3F;
 }
 
-int make_castle_r(board *b) {
-    return (b->turn) ? make_castle_w_r(b): make_castle_b_r(b);
+int move_flags(move m) {
+    return m >> 12;
 }
 
-void undo_castle_l(board *b, board* old_board) {
-    board_copy(b, old_board);
+int is_capture(move m) {
+    return (m >> 12) & CAPTURE;
 }
 
-void undo_castle_r(board *b, board* old_board) {
-    board_copy(b, old_board);
+int is_promotion(move m) {
+    return (m >> 12) & PROMOTION;
 }
 
-int can_castle_l(board *b) {
-    return ((b->turn) ? b->castle_w_l: b->castle_b_l);
+int promotion_piece(move m) {
+    return KNIGHT + ((m >> 12) & 3);
 }
 
-int can_castle_r(board *b) {
-    return ((b->turn) ? b->castle_w_r: b->castle_b_r);
+/*
+ * Returns piece type of side found on single bit location pos or NO_PIECE 
+ * if empty or held by the other side.
+*/
+int piece_on(board* b, uint64_t pos, int side) {
+    int code = square_code(b, __builtin_ctzll(pos));
+    // Empty squares decode as a black NO_PIECE so need no separate test.
+    return (code >> 3 == side) ? code & 7: NO_PIECE;
 }
 
-int promotion(board* b, int side) {
-    return (side) ? b->pawn_w & ~rank_8: b->pawn_b & ~rank_1;
+/*
+ * Rebuilds the mailbox from the bitboards.
+*/
+void set_mailbox(board* b) {
+    memset(b->squares, EMPTY_SQUARES, sizeof(b->squares));
+    for (int side = BLACK; side <= WHITE; side++) {
+        for (int piece = PAWN; piece <= KING; piece++) {
+            uint64_t pieces = piece_board(b, side, piece);
+            while (pieces) {
+                set_square_code(b, pop_lsb(&pieces), mailbox_code(side, piece));
+            }
+        }
+    }
 }
 
 /*
- * Copy of perft function with print at first level. Allows analysis of number 
- * of nodes generated after the first move. 
+ * True if every square of the mailbox names exactly the piece the 
+ * bitboards hold there. Checked after every move in debug builds.
 */
-uint64_t perft_divide(board* b, int depth) {
-    //printf("Board in perft %s\n", board_string(b));
-    if (!depth) return 1;
-    uint64_t nodes = 0;
-    uint64_t moves = get_legal_moves(b);
-    uint64_t move_pieces = (queen_move_board(moves, get_opp_side(b), get_curr_side(b)) \
-                                | knight_move_board(moves, get_opp_side(b))) & get_curr_side(b);
-   
-    board* b_copy = board_alloc();
-    board_copy(b_copy, b);
-
-    uint64_t from_mask = 1;
-    while (from_mask) {
-        uint64_t from = move_pieces & from_mask;
-        if (from) { 
-            uint64_t piece_moves = move_board(b, from) & moves;
-            if (piece_moves) {
-                uint64_t to_mask = 1;
-                while (to_mask) {
-                    uint64_t to = piece_moves & to_mask;
-                    if (to) {
-                        make_move(from, to, b, 1);
-                        if (promotion(b, !b->turn)) {
-                            if (!b->turn) { 
-                                uint64_t promoted = b->pawn_w & ~rank_8;
-                                b->pawn_w &= rank_8;
-                                b->knight_w |= promoted;
-                                uint64_t new_nodes = perft(b, depth - 1);
-                                printf("%" PRIu64 "\n", new_nodes);
-                                nodes += new_nodes;
-                                b->knight_w &= ~promoted;
-                                b->queen_w |= promoted;
-                                new_nodes = perft(b, depth - 1);
-                                printf("%" PRIu64 "\n", new_nodes);
-                                nodes += new_nodes;
-                                b->queen_w &= ~promoted;
-                                b->bishop_w |= promoted;
-                                new_nodes = perft(b, depth - 1);
-                                printf("%" PRIu64 "\n", new_nodes);
-                                nodes += new_nodes;
-                                b->bishop_w &= ~promoted;
-                                b->rook_w |= promoted;
-                                new_nodes = perft(b, depth - 1);
-                                printf("%" PRIu64 "\n", new_nodes);
-                                nodes += new_nodes;
-                            } else { 
-                                uint64_t promoted = b->pawn_b & ~rank_1;
-                                b->pawn_b &= rank_1;
-                                b->knight_b |= promoted;
-                                uint64_t new_nodes = perft(b, depth - 1);
-                                printf("%" PRIu64 "\n", new_nodes);
-                                nodes += new_nodes;
-                                b->knight_b &= ~promoted;
-                                b->queen_b |= promoted;
-                                new_nodes = perft(b, depth - 1);
-                                printf("%" PRIu64 "\n", new_nodes);
-                                nodes += new_nodes;
-                                b->queen_b &= ~promoted;
-                                b->bishop_b |= promoted;
-                                new_nodes = perft(b, depth - 1);
-                                printf("%" PRIu64 "\n", new_nodes);
-                                nodes += new_nodes;
-                                b->bishop_b &= ~promoted;
-                                b->rook_b |= promoted;
-                                new_nodes = perft(b, depth - 1);
-                                printf("%" PRIu64 "\n", new_nodes);
-                                nodes += new_nodes;
-                            }
-                        }
-                        // If the current side is not in check after move, use node.
-                        else if (!in_check(b, !b->turn)) {
-                            uint64_t new_nodes = perft(b, depth - 1);
-                            printf("%" PRIu64 "\n", new_nodes);
-                            nodes += new_nodes;
-                        }
-                        board_copy(b, b_copy);
-                    }
-                    to_mask = to_mask << 1;
+int mailbox_consistent(board* b) {
+    for (int sq = 0; sq < 64; sq++) {
+        uint64_t pos = (uint64_t) 1 << sq;
+        int expected = NO_PIECE;
+        int found = 0;
+        for (int side = BLACK; side <= WHITE; side++) {
+            for (int piece = PAWN; piece <= KING; piece++) {
+                if (piece_board(b, side, piece) & pos) {
+                    expected = mailbox_code(side, piece);
+                    found++;
                 }
             }
         }
-        from_mask = from_mask << 1;
+        if (found > 1 || square_code(b, sq) != expected) return 0;
     }
+    return 1;
+}
 
-    // Compute castling boards 
-    if (can_castle_l(b)) {
-        if (make_castle_l(b)) {
-            nodes += perft(b, depth - 1);
-            board_copy(b, b_copy);
-        }
-    } 
-    if (can_castle_r(b)) {
-        if (make_castle_r(b)) {
-            nodes += perft(b, depth - 1);
-            board_copy(b, b_copy);
+/*
+ * Zobrist keys. The position key is the XOR of one random key per piece on
+ * its square, the castle rights, the en passant file and the side to move.
+*/
+uint64_t zobrist_pieces[2][6][64];
+uint64_t zobrist_castle[16];
+uint64_t zobrist_en_passant[8];
+uint64_t zobrist_side;
+
+void init_zobrist() {
+    uint64_t seed = 1070372;
+    for (int side = BLACK; side <= WHITE; side++) {
+        for (int piece = PAWN; piece <= KING; piece++) {
+            for (int sq = 0; sq < 64; sq++) {
+                zobrist_pieces[side][piece][sq] = magic_rand(&seed);
+            }
         }
     }
-    board_delete(b_copy);
-
-    return nodes;
+    for (int i = 0; i < 16; i++) {
+        zobrist_castle[i] = magic_rand(&seed);
+    }
+    for (int i = 0; i < 8; i++) {
+        zobrist_en_passant[i] = magic_rand(&seed);
+    }
+    zobrist_side = magic_rand(&seed);
 }
 
 /*
- * Perft testing function. Evaluates entire search tree with no pruning and counts 
- * number of nodes generated. 
+ * Computes position key from scratch. Used when setting up a board and to
+ * verify the incremental key in debug builds.
 */
-uint64_t perft(board* b, int depth) {
-    //printf("Board in perft %s\n", board_string(b));
-    if (!depth) return 1;
-    uint64_t nodes = 0;
-    uint64_t moves = get_legal_moves(b);
-    uint64_t move_pieces = (queen_move_board(moves, get_opp_side(b), get_curr_side(b)) \
-                                | knight_move_board(moves, get_opp_side(b))) & get_curr_side(b);
-   
-    board* b_copy = board_alloc();
-    board_copy(b_copy, b);
-
-    uint64_t from_mask = 1;
-    while (from_mask) {
-        uint64_t from = move_pieces & from_mask;
-        if (from) { 
-            uint64_t piece_moves = move_board(b, from) & moves;
-            if (piece_moves) {
-                uint64_t to_mask = 1;
-                while (to_mask) {
-                    uint64_t to = piece_moves & to_mask;
-                    if (to) {
-                        make_move(from, to, b, 0);
-                        // Promotion requires 4 separate calls to make move. 
-                        // Might be able to change to adding one of each piece to board
-                        // when pawn on rank_7 or rank_1.  
-                        if (promotion(b, !b->turn)) {
-                            if (!b->turn) { 
-                                uint64_t promoted = b->pawn_w & ~rank_8;
-                                b->pawn_w &= rank_8;
-                                b->knight_w |= promoted;
-                                nodes += perft(b, depth - 1);
-                                b->knight_w &= ~promoted;
-                                b->queen_w |= promoted;
-                                nodes += perft(b, depth - 1);
-                                b->queen_w &= ~promoted;
-                                b->bishop_w |= promoted;
-                                nodes += perft(b, depth - 1);
-                                b->bishop_w &= ~promoted;
-                                b->rook_w |= promoted;
-                                nodes += perft(b, depth - 1);
-                            } else { 
-                                uint64_t promoted = b->pawn_b & ~rank_1;
-                                b->pawn_b &= rank_1;
-                                b->knight_b |= promoted;
-                                nodes += perft(b, depth - 1);
-                                b->knight_b &= ~promoted;
-                                b->queen_b |= promoted;
-                                nodes += perft(b, depth - 1);
-                                b->queen_b &= ~promoted;
-                                b->bishop_b |= promoted;
-                                nodes += perft(b, depth - 1);
-                                b->bishop_b &= ~promoted;
-                                b->rook_b |= promoted;
-                                nodes += perft(b, depth - 1);
-                            }
-                        }
-                        // If the current side is not in check after move, use node.
-                        else if (!in_check(b, !b->turn)) {
-                            nodes += perft(b, depth - 1);
-                        }
-                        board_copy(b, b_copy);
-                    }
-                    to_mask = to_mask << 1;
-                }
+uint64_t compute_key(board* b) {
+    uint64_t key = 0;
+    for (int side = BLACK; side <= WHITE; side++) {
+        for (int piece = PAWN; piece <= KING; piece++) {
+            uint64_t pieces = piece_board(b, side, piece);
+            while (pieces) {
+                key ^= zobrist_pieces[side][piece][pop_lsb(&pieces)];
             }
         }
-        from_mask = from_mask << 1;
     }
+    key ^= zobrist_castle[get_castle_rights(b)];
+    if (en_passant_square(b)) {
+        key ^= zobrist_en_passant[en_passant_square(b) % 8];
+    }
+    if (!side_to_move(b)) {
+        key ^= zobrist_side;
+    }
+    return key;
+}
 
-    // Compute castling boards 
-    if (can_castle_l(b)) {
-        if (make_castle_l(b)) {
-            nodes += perft(b, depth - 1);
-            board_copy(b, b_copy);
-        }
-    } 
-    if (can_castle_r(b)) {
-        if (make_castle_r(b)) {
-            nodes += perft(b, depth - 1);
-            board_copy(b, b_copy);
+uint64_t compute_pawn_key(board* b) {
+    uint64_t key = 0;
+    for (int side = BLACK; side <= WHITE; side++) {
+        uint64_t pieces = piece_board(b, side, PAWN);
+        while (pieces) {
+            key ^= zobrist_pieces[side][PAWN][pop_lsb(&pieces)];
         }
+        key ^= zobrist_pieces[side][KING][__builtin_ctzll(piece_board(b, side, KING))];
     }
-    board_delete(b_copy);
-
-    return nodes;
+    return key;
 }
 
-/* 
- * Not yet implemented. Will being standard game and start loop of asking for 
- * user input. Moves will be validated using move gen. 
- */
-void play_game() {
-    board* b = board_alloc();
-    set_standard(b);
-    
+/*
+ * Tapered evaluation terms. Every piece adds a middlegame and an endgame 
+ * value for its type and square, negated for black, and its weight to the 
+ * game phase. The totals are kept on the board by do_move and undo_move and 
+ * blended by phase in evaluate, so a full phase of 24 is the opening and 0 
+ * a bare king ending. Tables are PeSTO's, written from white's view with 
+ * rank 8 first as they would be read off a diagram.
+*/
+#define PHASE_MAX 24
+
+int piece_phase[6] = {0, 1, 1, 2, 4, 0};
+int mg_value[6] = {82, 337, 365, 477, 1025, 0};
+int eg_value[6] = {94, 281, 297, 512, 936, 0};
+
+int mg_table[6][64] = {
+    {
+          0,   0,   0,   0,   0,   0,   0,   0,
+         98, 134,  61,  95,  68, 126,  34, -11,
+         -6,   7,  26,  31,  65,  56,  25, -20,
+        -14,  13,   6,  21,  23,  12,  17, -23,
+        -27,  -2,  -5,  12,  17,   6,  10, -25,
+        -26,  -4,  -4, -10,   3,   3,  33, -12,
+        -35,  -1, -20, -23, -15,  24,  38, -22,
+          0,   0,   0,   0,   0,   0,   0,   0
+    }, {
+       -167, -89, -34, -49,  61, -97, -15,-107,
+        -73, -41,  72,  36,  23,  62,   7, -17,
+        -47,  60,  37,  65,  84, 129,  73,  44,
+         -9,  17,  19,  53,  37,  69,  18,  22,
+        -13,   4,  16,  13,  28,  19,  21,  -8,
+        -23,  -9,  12,  10,  19,  17,  25, -16,
+        -29, -53, -12,  -3,  -1,  18, -14, -19,
+       -105, -21, -58, -33, -17, -28, -19, -23
+    }, {
+        -29,   4, -82, -37, -25, -42,   7,  -8,
+        -26,  16, -18, -13,  30,  59,  18, -47,
+        -16,  37,  43,  40,  35,  50,  37,  -2,
+         -4,   5,  19,  50,  37,  37,   7,  -2,
+         -6,  13,  13,  26,  34,  12,  10,   4,
+          0,  15,  15,  15,  14,  27,  18,  10,
+          4,  15,  16,   0,   7,  21,  33,   1,
+        -33,  -3, -14, -21, -13, -12, -39, -21
+    }, {
+         32,  42,  32,  51,  63,   9,  31,  43,
+         27,  32,  58,  62,  80,  67,  26,  44,
+         -5,  19,  26,  36,  17,  45,  61,  16,
+        -24, -11,   7,  26,  24,  35,  -8, -20,
+        -36, -26, -12,  -1,   9,  -7,   6, -23,
+        -45, -25, -16, -17,   3,   0,  -5, -33,
+        -44, -16, -20,  -9,  -1,  11,  -6, -71,
+        -19, -13,   1,  17,  16,   7, -37, -26
+    }, {
+        -28,   0,  29,  12,  59,  44,  43,  45,
+        -24, -39,  -5,   1, -16,  57,  28,  54,
+        -13, -17,   7,   8,  29,  56,  47,  57,
+        -27, -27, -16, -16,  -1,  17,  -2,   1,
+         -9, -26,  -9, -10,  -2,  -4,   3,  -3,
+        -14,   2, -11,  -2,  -5,   2,  14,   5,
+        -35,  -8,  11,   2,   8,  15,  -3,   1,
+         -1, -18,  -9,  10, -15, -25, -31, -50
+    }, {
+        -65,  23,  16, -15, -56, -34,   2,  13,
+         29,  -1, -20,  -7,  -8,  -4, -38, -29,
+         -9,  24,   2, -16, -20,   6,  22, -22,
+        -17, -20, -12, -27, -30, -25, -14, -36,
+        -49,  -1, -27, -39, -46, -44, -33, -51,
+        -14, -14, -22, -46, -44, -30, -15, -27,
+          1,   7,  -8, -64, -43, -16,   9,   8,
+        -15,  36,  12, -54,   8, -28,  24,  14
+    }
+};
+
+int eg_table[6][64] = {
+    {
+          0,   0,   0,   0,   0,   0,   0,   0,
+        178, 173, 158, 134, 147, 132, 165, 187,
+         94, 100,  85,  67,  56,  53,  82,  84,
+         32,  24,  13,   5,  -2,   4,  17,  17,
+         13,   9,  -3,  -7,  -7,  -8,   3,  -1,
+          4,   7,  -6,   1,   0,  -5,  -1,  -8,
+         13,   8,   8,  10,  13,   0,   2,  -7,
+          0,   0,   0,   0,   0,   0,   0,   0
+    }, {
+        -58, -38, -13, -28, -31, -27, -63, -99,
+        -25,  -8, -25,  -2,  -9, -25, -24, -52,
+        -24, -20,  10,   9,  -1,  -9, -19, -41,
+        -17,   3,  22,  22,  22,  11,   8, -18,
+        -18,  -6,  16,  25,  16,  17,   4, -18,
+        -23,  -3,  -1,  15,  10,  -3, -20, -22,
+        -42, -20, -10,  -5,  -2, -20, -23, -44,
+        -29, -51, -23, -15, -22, -18, -50, -64
+    }, {
+        -14, -21, -11,  -8,  -7,  -9, -17, -24,
+         -8,  -4,   7, -12,  -3, -13,  -4, -14,
+          2,  -8,   0,  -1,  -2,   6,   0,   4,
+         -3,   9,  12,   9,  14,  10,   3,   2,
+         -6,   3,  13,  19,   7,  10,  -3,  -9,
+        -12,  -3,   8,  10,  13,   3,  -7, -15,
+        -14, -18,  -7,  -1,   4,  -9, -15, -27,
+        -23,  -9, -23,  -5,  -9, -16,  -5, -17
+    }, {
+         13,  10,  18,  15,  12,  12,   8,   5,
+         11,  13,  13,  11,  -3,   3,   8,   3,
+          7,   7,   7,   5,   4,  -3,  -5,  -3,
+          4,   3,  13,   1,   2,   1,  -1,   2,
+          3,   5,   8,   4,  -5,  -6,  -8, -11,
+         -4,   0,  -5,  -1,  -7, -12,  -8, -16,
+         -6,  -6,   0,   2,  -9,  -9, -11,  -3,
+         -9,   2,   3,  -1,  -5, -13,   4, -20
+    }, {
+         -9,  22,  22,  27,  27,  19,  10,  20,
+        -17,  20,  32,  41,  58,  25,  30,   0,
+        -20,   6,   9,  49,  47,  35,  19,   9,
+          3,  22,  24,  45,  57,  40,  57,  36,
+        -18,  28,  19,  47,  31,  34,  39,  23,
+        -16, -27,  15,   6,   9,  17,  10,   5,
+        -22, -23, -30, -16, -16, -23, -36, -32,
+        -33, -28, -22, -43,  -5, -32, -20, -41
+    }, {
+        -74, -35, -18, -18, -11,  15,   4, -17,
+        -12,  17,  14,  17,  17,  38,  23,  11,
+         10,  17,  23,  15,  20,  45,  44,  13,
+         -8,  22,  24,  27,  26,  33,  26,   3,
+        -18,  -4,  21,  24,  27,  23,   9, -11,
+        -19,  -3,  11,  21,  23,  16,   7,  -9,
+        -27, -11,   4,  13,  14,   4,  -5, -17,
+        -53, -34, -21, -11, -28, -14, -24, -43
+    }
+};
+
+// Signed value of each piece on each square for both sides, indexed by our square numbering.
+int pst_mg[2][6][64];
+int pst_eg[2][6][64];
+
+void init_eval() {
+    for (int piece = PAWN; piece <= KING; piece++) {
+        for (int sq = 0; sq < 64; sq++) {
+            // Table row 0 is rank 8, so white flips the rank and black reads its own view directly.
+            pst_mg[WHITE][piece][sq] = mg_value[piece] + mg_table[piece][sq ^ 56];
+            pst_eg[WHITE][piece][sq] = eg_value[piece] + eg_table[piece][sq ^ 56];
+            pst_mg[BLACK][piece][sq] = -(mg_value[piece] + mg_table[piece][sq]);
+            pst_eg[BLACK][piece][sq] = -(eg_value[piece] + eg_table[piece][sq]);
+        }
+    }
+}
+
+/*
+ * Sets the evaluation totals of b from scratch.
+*/
+void compute_eval(board* b) {
+    b->mg_score = 0;
+    b->eg_score = 0;
+    b->phase = 0;
+    for (int side = BLACK; side <= WHITE; side++) {
+        for (int piece = PAWN; piece <= KING; piece++) {
+            uint64_t pieces = piece_board(b, side, piece);
+            while (pieces) {
+                int sq = pop_lsb(&pieces);
+                b->mg_score += pst_mg[side][piece][sq];
+                b->eg_score += pst_eg[side][piece][sq];
+                b->phase += piece_phase[piece];
+            }
+        }
+    }
+}
+
+/*
+ * Debug check that the incremental totals of b match a full recount.
+*/
+int eval_consistent(board* b) {
+    board scratch = *b;
+    compute_eval(&scratch);
+    return scratch.mg_score == b->mg_score && scratch.eg_score == b->eg_score && scratch.phase == b->phase;
+}
+
+/*
+ * Pawn structure terms from white's view: passed pawns by how far they have 
+ * advanced, isolated and doubled pawns, and own pawns sheltering the king 
+ * one or two ranks in front of it. They depend only on where the pawns and 
+ * kings stand so are cached in a pawn table keyed by pawn_key.
+*/
+int passed_mg[8] = {0, 5, 10, 15, 25, 45, 70, 0};
+int passed_eg[8] = {0, 10, 15, 25, 45, 75, 120, 0};
+int isolated_mg = -10;
+int isolated_eg = -15;
+int doubled_mg = -10;
+int doubled_eg = -25;
+int shield_near_mg = 12;
+int shield_far_mg = 6;
+
+uint64_t file_masks[8];
+uint64_t adjacent_files[8];
+// Squares in front of a pawn on its own and adjacent files, an enemy pawn in which stops it being passed.
+uint64_t passed_masks[2][64];
+// Squares on the king's file and its neighbours one and two ranks in front of the king.
+uint64_t shield_near[2][64];
+uint64_t shield_far[2][64];
+
+void init_pawn_masks() {
+    for (int file = 0; file < 8; file++) {
+        file_masks[file] = (uint64_t) 0x0101010101010101 << file;
+    }
+    for (int file = 0; file < 8; file++) {
+        adjacent_files[file] = ((file) ? file_masks[file - 1]: 0) | ((file < 7) ? file_masks[file + 1]: 0);
+    }
+    for (int sq = 0; sq < 64; sq++) {
+        uint64_t files = file_masks[sq % 8] | adjacent_files[sq % 8];
+        uint64_t above = (sq < 56) ? ~(uint64_t) 0 << (sq / 8 * 8 + 8): 0;
+        uint64_t below = ((uint64_t) 1 << (sq / 8 * 8)) - 1;
+        passed_masks[WHITE][sq] = files & above;
+        passed_masks[BLACK][sq] = files & below;
+
+        uint64_t rank = (uint64_t) 0xFF << (sq / 8 * 8);
+        shield_near[WHITE][sq] = files & (rank << 8);
+        shield_far[WHITE][sq] = files & (rank << 16);
+        shield_near[BLACK][sq] = files & (rank >> 8);
+        shield_far[BLACK][sq] = files & (rank >> 16);
+    }
+}
+
+/*
+ * Computes the pawn structure terms of b from scratch.
+*/
+void pawn_structure(board* b, int* mg, int* eg) {
+    *mg = 0;
+    *eg = 0;
+    for (int side = BLACK; side <= WHITE; side++) {
+        int sign = (side) ? 1: -1;
+        uint64_t own = piece_board(b, side, PAWN);
+        uint64_t opp = piece_board(b, !side, PAWN);
+        uint64_t pawns = own;
+        while (pawns) {
+            int sq = pop_lsb(&pawns);
+            if (!(opp & passed_masks[side][sq])) {
+                int rank = (side) ? sq / 8: 7 - sq / 8;
+                *mg += sign * passed_mg[rank];
+                *eg += sign * passed_eg[rank];
+            }
+            if (!(own & adjacent_files[sq % 8])) {
+                *mg += sign * isolated_mg;
+                *eg += sign * isolated_eg;
+            }
+        }
+        for (int file = 0; file < 8; file++) {
+            int count = __builtin_popcountll(own & file_masks[file]);
+            if (count > 1) {
+                *mg += sign * doubled_mg * (count - 1);
+                *eg += sign * doubled_eg * (count - 1);
+            }
+        }
+        int king_sq = __builtin_ctzll(piece_board(b, side, KING));
+        *mg += sign * (shield_near_mg * __builtin_popcountll(own & shield_near[side][king_sq]) \
+                     + shield_far_mg * __builtin_popcountll(own & shield_far[side][king_sq]));
+    }
+}
+
+/*
+ * Direct mapped cache of pawn structure terms. Each search thread owns one 
+ * so entries need no synchronisation.
+*/
+#define PAWN_TABLE_SIZE 16384
+
+typedef struct pawn_entry {
+    uint64_t key;
+    int16_t mg_score;
+    int16_t eg_score;
+} pawn_entry;
+
+typedef struct pawn_table {
+    pawn_entry entries[PAWN_TABLE_SIZE];
+    uint64_t hits;
+    uint64_t misses;
+} pawn_table;
+
+void pawn_table_clear(pawn_table* t) {
+    memset(t, 0, sizeof(pawn_table));
+}
+
+/*
+ * Sets the pawn structure terms of b, from t if cached. t may be NULL to 
+ * always compute them.
+*/
+void pawn_eval(board* b, pawn_table* t, int* mg, int* eg) {
+    if (!t) {
+        pawn_structure(b, mg, eg);
+        return;
+    }
+    pawn_entry* entry = &t->entries[b->pawn_key & (PAWN_TABLE_SIZE - 1)];
+    if (entry->key == b->pawn_key) {
+        t->hits++;
+        *mg = entry->mg_score;
+        *eg = entry->eg_score;
+        return;
+    }
+    t->misses++;
+    pawn_structure(b, mg, eg);
+    entry->key = b->pawn_key;
+    entry->mg_score = *mg;
+    entry->eg_score = *eg;
+}
+
+void pawn_table_report(pawn_table* t) {
+    uint64_t probes = t->hits + t->misses;
+    printf("Pawn table: %" PRIu64 " hits, %" PRIu64 " misses, %.1f%% hit rate\n", \
+           t->hits, t->misses, (probes) ? 100.0 * t->hits / probes: 0.0);
+}
+
+/*
+ * Returns pieces of side which attack square sq when the board holds occupied.
+*/
+static ALWAYS_INLINE uint64_t side_attackers_to(board* b, int sq, uint64_t occupied, int side) {
+    uint64_t queens = piece_board(b, side, QUEEN);
+    // A pawn of side attacks sq exactly when a pawn of the other side on sq would attack it.
+    return (pawn_attacks(!side, sq) & piece_board(b, side, PAWN)) \
+         | (knight_attacks(sq) & piece_board(b, side, KNIGHT)) \
+         | (king_attacks(sq) & piece_board(b, side, KING)) \
+         | (rook_attacks(sq, occupied) & (piece_board(b, side, ROOK) | queens)) \
+         | (bishop_attacks(sq, occupied) & (piece_board(b, side, BISHOP) | queens));
+}
+
+/*
+ * Returns pieces of both sides which attack square sq when the board holds 
+ * occupied. Sliders see through anything missing from occupied, so taking 
+ * pieces out of it uncovers the x-ray attackers lined up behind them.
+*/
+uint64_t attackers_to(board* b, int sq, uint64_t occupied) {
+    uint64_t queens = b->pieces[QUEEN];
+    return (pawn_attacks(BLACK, sq) & piece_board(b, WHITE, PAWN)) | (pawn_attacks(WHITE, sq) & piece_board(b, BLACK, PAWN)) \
+         | (knight_attacks(sq) & b->pieces[KNIGHT]) \
+         | (king_attacks(sq) & b->pieces[KING]) \
+         | (rook_attacks(sq, occupied) & (b->pieces[ROOK] | queens)) \
+         | (bishop_attacks(sq, occupied) & (b->pieces[BISHOP] | queens));
+}
+
+/*
+ * Returns every square attacked by side when the board holds occupied.
+*/
+static ALWAYS_INLINE uint64_t side_attacks(board* b, int side, uint64_t occupied) {
+    uint64_t pawns = piece_board(b, side, PAWN);
+    uint64_t attacks = (side) ? ((pawns & file_a) << 7) | ((pawns & file_h) << 9) \
+                              : ((pawns & file_a) >> 9) | ((pawns & file_h) >> 7);
+    uint64_t knights = piece_board(b, side, KNIGHT);
+    while (knights) {
+        attacks |= knight_attacks(pop_lsb(&knights));
+    }
+    attacks |= king_attacks(__builtin_ctzll(piece_board(b, side, KING)));
+    uint64_t queens = piece_board(b, side, QUEEN);
+    uint64_t rooks = piece_board(b, side, ROOK) | queens;
+    while (rooks) {
+        attacks |= rook_attacks(pop_lsb(&rooks), occupied);
+    }
+    uint64_t bishops = piece_board(b, side, BISHOP) | queens;
+    while (bishops) {
+        attacks |= bishop_attacks(pop_lsb(&bishops), occupied);
+    }
+    return attacks;
+}
+
+/*
+ * Returns true if m does not leave the mover's king attacked. Checks the 
+ * position the move would produce from occupancy alone, without making it.
+ * Castling is already checked for attacked squares when generated.
+*/
+int is_legal(board* b, move m) {
+    int side = side_to_move(b);
+    int flags = move_flags(m);
+    if (flags == CASTLE_RIGHT || flags == CASTLE_LEFT) return 1;
+
+    uint64_t from = (uint64_t) 1 << move_from(m);
+    uint64_t to = (uint64_t) 1 << move_to(m);
+    uint64_t king = piece_board(b, side, KING);
+    // Captured piece can no longer attack.
+    uint64_t removed = to;
+    if (flags == EN_PASSANT) {
+        removed |= (side) ? to >> 8: to << 8;
+    }
+    uint64_t occupied = (((b->colors[WHITE] | b->colors[BLACK]) & ~from) | to) & ~(removed & ~to);
+    int king_sq = __builtin_ctzll((king & from) ? to: king);
+    return !(side_attackers_to(b, king_sq, occupied, !side) & ~removed);
+}
+
+void add_move(move_list* list, int from, int to, int flags) {
+    list->moves[list->count++] = encode_move(from, to, flags);
+}
+
+void add_pawn_moves(move_list* list, int from, int to, int flags) {
+    if (to >= 56 || to < 8) {
+        int promote = (flags & CAPTURE) ? PROMOTION_CAPTURE: PROMOTION;
+        for (int piece = QUEEN; piece >= KNIGHT; piece--) {
+            add_move(list, from, to, promote | (piece - KNIGHT));
+        }
+    } else {
+        add_move(list, from, to, flags);
+    }
+}
+
+enum { GEN_ALL, GEN_CAPTURES, GEN_QUIETS };
+
+/*
+ * Returns squares piece of side on from can move to or capture on, ignoring 
+ * whether its king is left in check. En passant and castling are not included.
+*/
+static ALWAYS_INLINE uint64_t piece_targets(board* b, int side, int piece, uint64_t from) {
+    uint64_t own = b->colors[side];
+    uint64_t opp = b->colors[!side];
+    int sq = __builtin_ctzll(from);
+    switch (piece) {
+        case PAWN:
+            return pawn_move_board(from, own, opp, side);
+        case KNIGHT:
+            return knight_attacks(sq) & ~own;
+        case BISHOP:
+            return bishop_attacks(sq, own | opp) & ~own;
+        case ROOK:
+            return rook_attacks(sq, own | opp) & ~own;
+        case QUEEN:
+            return (rook_attacks(sq, own | opp) | bishop_attacks(sq, own | opp)) & ~own;
+        case KING:
+            return king_attacks(sq) & ~own;
+    }
+    return 0;
+}
+
+/*
+ * Fills list with the legal moves of the side to move and returns how many 
+ * there are. Checkers, pins and squares attacked around the king are found 
+ * once up front so every emitted move is legal without making it:
+ * - the king only steps to squares the opponent does not attack with the 
+ *   king lifted off the board, so it cannot retreat along a checking ray
+ * - other pieces must capture a single checker or block its ray, and may 
+ *   not move at all in double check
+ * - a pinned piece stays on the line through its king and pinner
+ * En passant can expose the king along the rank of both pawns so it alone is 
+ * checked with is_legal.
+ * mode restricts the list to captures and promotions, to the remaining quiet 
+ * moves, or gives all of them in the order squares are scanned.
+ * side must be the side to move, see generate.
+*/
+static ALWAYS_INLINE int generate_side(board* b, move_list* list, int mode, int side) {
+    uint64_t own = b->colors[side];
+    uint64_t opp = b->colors[!side];
+    uint64_t occupied = own | opp;
+    uint64_t king = piece_board(b, side, KING);
+    int king_sq = __builtin_ctzll(king);
+    uint64_t ep = en_passant_target(b);
+    uint64_t promotion_rank = (side) ? (uint64_t) 0xFF << 56: 0xFF;
+    list->count = 0;
+
+    uint64_t danger = side_attacks(b, !side, occupied ^ king);
+    uint64_t checkers = side_attackers_to(b, king_sq, occupied, !side);
+    uint64_t check_mask = ~(uint64_t) 0;
+    if (checkers & (checkers - 1)) {
+        check_mask = 0;
+    } else if (checkers) {
+        check_mask = between[king_sq][__builtin_ctzll(checkers)] | checkers;
+    }
+
+    // Enemy sliders which would attack the king if our own pieces were lifted.
+    uint64_t opp_queens = piece_board(b, !side, QUEEN);
+    uint64_t snipers = (rook_attacks(king_sq, opp) & (piece_board(b, !side, ROOK) | opp_queens)) \
+                     | (bishop_attacks(king_sq, opp) & (piece_board(b, !side, BISHOP) | opp_queens));
+    uint64_t pinned = 0;
+    while (snipers) {
+        uint64_t blockers = between[king_sq][pop_lsb(&snipers)] & occupied;
+        if (!(blockers & (blockers - 1))) {
+            pinned |= blockers & own;
+        }
+    }
+
+    uint64_t pieces = own;
+    while (pieces) {
+        int from = pop_lsb(&pieces);
+        uint64_t from_bb = (uint64_t) 1 << from;
+        int piece = piece_on(b, from_bb, side);
+        uint64_t targets = piece_targets(b, side, piece, from_bb);
+        if (piece == KING) {
+            targets &= ~danger;
+        } else {
+            targets &= check_mask;
+            if (pinned & from_bb) {
+                targets &= line[king_sq][from];
+            }
+        }
+        uint64_t noisy = opp | ((piece == PAWN) ? promotion_rank: 0);
+        if (mode == GEN_CAPTURES) {
+            targets &= noisy;
+        } else if (mode == GEN_QUIETS) {
+            targets &= ~noisy;
+        }
+
+        while (targets) {
+            int to = pop_lsb(&targets);
+            uint64_t to_bb = (uint64_t) 1 << to;
+            int flags = (opp & to_bb) ? CAPTURE: QUIET;
+            if (piece == PAWN) {
+                if (to - from == 16 || from - to == 16) {
+                    flags = DOUBLE_PUSH;
+                }
+                add_pawn_moves(list, from, to, flags);
+            } else {
+                add_move(list, from, to, flags);
+            }
+        }
+
+        if (piece == PAWN && ep && mode != GEN_QUIETS) {
+            if (pawn_attacks(side, from) & ep) {
+                move m = encode_move(from, __builtin_ctzll(ep), EN_PASSANT);
+                if (is_legal(b, m)) {
+                    add_move(list, from, __builtin_ctzll(ep), EN_PASSANT);
+                }
+            }
+        }
+    }
+
+    // Castling needs the king and rook home, nothing between them and no attacked square on the king's path.
+    int home = (side) ? 0: 56;
+    uint64_t rooks = piece_board(b, side, ROOK);
+    if (king == (uint64_t) 0x10 << home && !checkers && mode != GEN_CAPTURES) {
+        if ((get_castle_rights(b) & ((side) ? CASTLE_W_R: CASTLE_B_R)) && (rooks & ((uint64_t) 0x80 << home)) && !(occupied & ((uint64_t) 0x60 << home)) \
+                && !(danger & ((uint64_t) 0x60 << home))) {
+            add_move(list, home + 4, home + 6, CASTLE_RIGHT);
+        }
+        if ((get_castle_rights(b) & ((side) ? CASTLE_W_L: CASTLE_B_L)) && (rooks & ((uint64_t) 0x01 << home)) && !(occupied & ((uint64_t) 0x0E << home)) \
+                && !(danger & ((uint64_t) 0x0C << home))) {
+            add_move(list, home + 4, home + 2, CASTLE_LEFT);
+        }
+    }
+    return list->count;
+}
+
+/*
+ * Generates for the side to move through the copy of generate_side built for 
+ * that side.
+*/
+int generate(board* b, move_list* list, int mode) {
+    return (side_to_move(b)) ? generate_side(b, list, mode, WHITE): generate_side(b, list, mode, BLACK);
+}
+
+/*
+ * Fills list with all legal moves of the side to move and returns how many there are.
+*/
+int generate_moves(board* b, move_list* list) {
+    return generate(b, list, GEN_ALL);
+}
+
+/*
+ * Returns true if m, eg. a stored hash or killer move, is legal in b. 
+ * Castling is never accepted here and is left to generation.
+*/
+int move_valid(board* b, move m) {
+    int side = side_to_move(b);
+    int flags = move_flags(m);
+    uint64_t from = (uint64_t) 1 << move_from(m);
+    uint64_t to = (uint64_t) 1 << move_to(m);
+    uint64_t opp = get_opp_side(b);
+    if (!m || !(get_curr_side(b) & from) || flags == CASTLE_RIGHT || flags == CASTLE_LEFT) return 0;
+
+    int piece = piece_on(b, from, side);
+    if (flags == EN_PASSANT) {
+        if (piece != PAWN || to != en_passant_target(b)) return 0;
+        return (pawn_attacks(side, move_from(m)) & to) && is_legal(b, m);
+    }
+    uint64_t promotion_rank = (side) ? (uint64_t) 0xFF << 56: 0xFF;
+    int double_push = piece == PAWN && (move_to(m) - move_from(m) == 16 || move_from(m) - move_to(m) == 16);
+    // Flags are compared as truth values, is_capture and is_promotion return the flag bits.
+    if (!!is_capture(m) != !!(opp & to) || !!is_promotion(m) != (piece == PAWN && !!(to & promotion_rank)) \
+            || (flags == DOUBLE_PUSH) != double_push || (!is_promotion(m) && flags > CAPTURE)) {
+        return 0;
+    }
+    return (piece_targets(b, side, piece, from) & to) && is_legal(b, m);
+}
+
+/*
+ * Returns union of destination squares of all legal moves for side.
+*/
+uint64_t legal_move_targets(board* b, int side) {
+    uint16_t state = b->state;
+    if (side != side_to_move(b)) {
+        // The en passant target belongs to the side to move, and would be 
+        // read on the wrong rank for the other side.
+        set_en_passant(b, 0);
+        set_side_to_move(b, side);
+    }
+    move_list list;
+    generate_moves(b, &list);
+    b->state = state;
+
+    uint64_t targets = 0;
+    for (int i = 0; i < list.count; i++) {
+        targets |= (uint64_t) 1 << move_to(list.moves[i]);
+    }
+    return targets;
+}
+
+uint64_t get_legal_moves(board *b) {
+    return legal_move_targets(b, side_to_move(b));
+}
+
+/*
+ * Counts legal moves for the side to move without making any of them.
+*/
+int count_legal_moves(board* b) {
+    move_list list;
+    return generate_moves(b, &list);
+}
+
+/*
+ * Clears castling rights for any king or rook home square touched by a move.
+*/
+void update_castle_rights(board* b, uint64_t squares) {
+    int rights = get_castle_rights(b);
+    if (squares & 0x0000000000000011) rights &= ~CASTLE_W_L;
+    if (squares & 0x0000000000000090) rights &= ~CASTLE_W_R;
+    if (squares & 0x1100000000000000) rights &= ~CASTLE_B_L;
+    if (squares & 0x9000000000000000) rights &= ~CASTLE_B_R;
+    set_castle_rights(b, rights);
+}
+
+/*
+ * Moves the piece on from_sq to to_sq in the mailbox.
+*/
+static inline void move_square_code(board* b, int from_sq, int to_sq) {
+    set_square_code(b, to_sq, square_code(b, from_sq));
+    set_square_code(b, from_sq, NO_PIECE);
+}
+
+/*
+ * Plays packed move m for the side to move, including captures, en passant,
+ * promotion and castling, then passes the turn. Fills u so undo_move can
+ * restore the position. side must be the side to move, see do_move.
+*/
+static ALWAYS_INLINE void do_move_side(board* b, move m, move_undo* u, int side) {
+    int flags = move_flags(m);
+    int from_sq = move_from(m);
+    int to_sq = move_to(m);
+    uint64_t from = (uint64_t) 1 << from_sq;
+    uint64_t to = (uint64_t) 1 << to_sq;
+    int piece = square_code(b, from_sq) & 7;
+
+    u->piece = piece;
+    u->captured = NO_PIECE;
+    u->castle = get_castle_rights(b);
+    u->en_passant = en_passant_square(b);
+    u->key = b->key;
+    u->pawn_key = b->pawn_key;
+    u->mg_score = b->mg_score;
+    u->eg_score = b->eg_score;
+    u->phase = b->phase;
+    u->halfmove = b->halfmove;
+    if (piece == PAWN || is_capture(m)) {
+        b->halfmove = 0;
+    } else if (b->halfmove < UINT8_MAX) {
+        b->halfmove++;
+    }
+
+    uint64_t key = b->key ^ zobrist_castle[u->castle] ^ zobrist_side;
+    int mg = b->mg_score + pst_mg[side][piece][to_sq] - pst_mg[side][piece][from_sq];
+    int eg = b->eg_score + pst_eg[side][piece][to_sq] - pst_eg[side][piece][from_sq];
+    uint64_t pawn_key = b->pawn_key;
+    if (piece == PAWN || piece == KING) {
+        pawn_key ^= zobrist_pieces[side][piece][from_sq] ^ zobrist_pieces[side][piece][to_sq];
+    }
+    if (u->en_passant) {
+        key ^= zobrist_en_passant[u->en_passant % 8];
+    }
+
+    if (flags == EN_PASSANT) {
+        int captured_sq = (side) ? to_sq - 8: to_sq + 8;
+        b->pieces[PAWN] ^= (uint64_t) 1 << captured_sq;
+        b->colors[!side] ^= (uint64_t) 1 << captured_sq;
+        set_square_code(b, captured_sq, NO_PIECE);
+        key ^= zobrist_pieces[!side][PAWN][captured_sq];
+        pawn_key ^= zobrist_pieces[!side][PAWN][captured_sq];
+        mg -= pst_mg[!side][PAWN][captured_sq];
+        eg -= pst_eg[!side][PAWN][captured_sq];
+    } else if (is_capture(m)) {
+        u->captured = square_code(b, to_sq) & 7;
+        b->pieces[u->captured] ^= to;
+        b->colors[!side] ^= to;
+        key ^= zobrist_pieces[!side][u->captured][to_sq];
+        if (u->captured == PAWN) {
+            pawn_key ^= zobrist_pieces[!side][PAWN][to_sq];
+        }
+        mg -= pst_mg[!side][u->captured][to_sq];
+        eg -= pst_eg[!side][u->captured][to_sq];
+        b->phase -= piece_phase[u->captured];
+    }
+
+    b->pieces[piece] ^= from | to;
+    b->colors[side] ^= from | to;
+    move_square_code(b, from_sq, to_sq);
+    key ^= zobrist_pieces[side][piece][from_sq] ^ zobrist_pieces[side][piece][to_sq];
+
+    if (is_promotion(m)) {
+        b->pieces[PAWN] ^= to;
+        b->pieces[promotion_piece(m)] ^= to;
+        set_square_code(b, to_sq, mailbox_code(side, promotion_piece(m)));
+        key ^= zobrist_pieces[side][PAWN][to_sq] ^ zobrist_pieces[side][promotion_piece(m)][to_sq];
+        pawn_key ^= zobrist_pieces[side][PAWN][to_sq];
+        mg += pst_mg[side][promotion_piece(m)][to_sq] - pst_mg[side][PAWN][to_sq];
+        eg += pst_eg[side][promotion_piece(m)][to_sq] - pst_eg[side][PAWN][to_sq];
+        b->phase += piece_phase[promotion_piece(m)];
+    } else if (flags == CASTLE_RIGHT) {
+        uint64_t rook = (to << 1) | (to >> 1);
+        b->pieces[ROOK] ^= rook;
+        b->colors[side] ^= rook;
+        move_square_code(b, to_sq + 1, to_sq - 1);
+        key ^= zobrist_pieces[side][ROOK][to_sq + 1] ^ zobrist_pieces[side][ROOK][to_sq - 1];
+        mg += pst_mg[side][ROOK][to_sq - 1] - pst_mg[side][ROOK][to_sq + 1];
+        eg += pst_eg[side][ROOK][to_sq - 1] - pst_eg[side][ROOK][to_sq + 1];
+    } else if (flags == CASTLE_LEFT) {
+        uint64_t rook = (to >> 2) | (to << 1);
+        b->pieces[ROOK] ^= rook;
+        b->colors[side] ^= rook;
+        move_square_code(b, to_sq - 2, to_sq + 1);
+        key ^= zobrist_pieces[side][ROOK][to_sq - 2] ^ zobrist_pieces[side][ROOK][to_sq + 1];
+        mg += pst_mg[side][ROOK][to_sq + 1] - pst_mg[side][ROOK][to_sq - 2];
+        eg += pst_eg[side][ROOK][to_sq + 1] - pst_eg[side][ROOK][to_sq - 2];
+    }
+
+    update_castle_rights(b, from | to);
+    key ^= zobrist_castle[get_castle_rights(b)];
+    set_en_passant(b, 0);
+    if (flags == DOUBLE_PUSH) {
+        set_en_passant(b, (side) ? from_sq + 8: from_sq - 8);
+        key ^= zobrist_en_passant[from_sq % 8];
+    }
+    set_side_to_move(b, !side);
+    b->key = key;
+    b->pawn_key = pawn_key;
+    b->mg_score = mg;
+    b->eg_score = eg;
+}
+
+/*
+ * Plays m for the side to move. Dispatches once to the copy of 
+ * do_move_side built for that side.
+*/
+void do_move(board* b, move m, move_undo* u) {
+    if (side_to_move(b)) {
+        do_move_side(b, m, u, WHITE);
+    } else {
+        do_move_side(b, m, u, BLACK);
+    }
+
+    assert(b->key == compute_key(b));
+    assert(b->pawn_key == compute_pawn_key(b));
+    assert(eval_consistent(b));
+    assert(mailbox_consistent(b));
+}
+
+/*
+ * Takes back move m played by side with do_move, restoring the position exactly.
+*/
+static ALWAYS_INLINE void undo_move_side(board* b, move m, move_undo* u, int side) {
+    int flags = move_flags(m);
+    int from_sq = move_from(m);
+    int to_sq = move_to(m);
+    uint64_t from = (uint64_t) 1 << from_sq;
+    uint64_t to = (uint64_t) 1 << to_sq;
+
+    if (is_promotion(m)) {
+        b->pieces[promotion_piece(m)] ^= to;
+        b->pieces[PAWN] ^= to;
+    } else if (flags == CASTLE_RIGHT) {
+        uint64_t rook = (to << 1) | (to >> 1);
+        b->pieces[ROOK] ^= rook;
+        b->colors[side] ^= rook;
+        move_square_code(b, to_sq - 1, to_sq + 1);
+    } else if (flags == CASTLE_LEFT) {
+        uint64_t rook = (to >> 2) | (to << 1);
+        b->pieces[ROOK] ^= rook;
+        b->colors[side] ^= rook;
+        move_square_code(b, to_sq + 1, to_sq - 2);
+    }
+
+    b->pieces[u->piece] ^= from | to;
+    b->colors[side] ^= from | to;
+    set_square_code(b, from_sq, mailbox_code(side, u->piece));
+    set_square_code(b, to_sq, NO_PIECE);
+
+    if (flags == EN_PASSANT) {
+        int captured_sq = (side) ? to_sq - 8: to_sq + 8;
+        b->pieces[PAWN] ^= (uint64_t) 1 << captured_sq;
+        b->colors[!side] ^= (uint64_t) 1 << captured_sq;
+        set_square_code(b, captured_sq, mailbox_code(!side, PAWN));
+    } else if (u->captured != NO_PIECE) {
+        b->pieces[u->captured] ^= to;
+        b->colors[!side] ^= to;
+        set_square_code(b, to_sq, mailbox_code(!side, u->captured));
+    }
+
+    set_castle_rights(b, u->castle);
+    set_en_passant(b, u->en_passant);
+    set_side_to_move(b, side);
+    b->key = u->key;
+    b->pawn_key = u->pawn_key;
+    b->mg_score = u->mg_score;
+    b->eg_score = u->eg_score;
+    b->phase = u->phase;
+    b->halfmove = u->halfmove;
+}
+
+/*
+ * Takes back move m, which was played by the side not to move.
+*/
+void undo_move(board* b, move m, move_undo* u) {
+    if (side_to_move(b)) {
+        undo_move_side(b, m, u, BLACK);
+    } else {
+        undo_move_side(b, m, u, WHITE);
+    }
+
+    assert(b->key == compute_key(b));
+    assert(b->pawn_key == compute_pawn_key(b));
+    assert(eval_consistent(b));
+    assert(mailbox_consistent(b));
+}
+
+/*
+ * Passes the turn without moving, for null move pruning. Only the side to 
+ * move, en passant, the key and the halfmove clock change. The clock 
+ * restarts so repetitions are not looked for across the null move.
+*/
+void do_null_move(board* b, move_undo* u) {
+    u->en_passant = en_passant_square(b);
+    u->key = b->key;
+    u->halfmove = b->halfmove;
+    b->halfmove = 0;
+    b->key ^= zobrist_side;
+    if (u->en_passant) {
+        b->key ^= zobrist_en_passant[u->en_passant % 8];
+    }
+    set_en_passant(b, 0);
+    set_side_to_move(b, !side_to_move(b));
+}
+
+void undo_null_move(board* b, move_undo* u) {
+    set_side_to_move(b, !side_to_move(b));
+    set_en_passant(b, u->en_passant);
+    b->key = u->key;
+    b->halfmove = u->halfmove;
+}
+
+/*
+ * Writes m in long algebraic notation, eg. e2e4 or e7e8q, into str which must hold 6 chars.
+*/
+void move_to_uci(move m, char* str) {
+    int from = move_from(m);
+    int to = move_to(m);
+    str[0] = file_names[from % 8];
+    str[1] = rank_names[from / 8];
+    str[2] = file_names[to % 8];
+    str[3] = rank_names[to / 8];
+    str[4] = (is_promotion(m)) ? piece_names[BLACK][promotion_piece(m)]: '\0';
+    str[5] = '\0';
+}
+
+/*
+ * Writes m in standard algebraic notation, eg. Nbd7, exd6, e8=Q+ or O-O-O#, 
+ * into str which must hold 8 chars. m must be legal in b, which is left as 
+ * it was.
+*/
+void move_to_san(board* b, move m, char* str) {
+    int from = move_from(m);
+    int to = move_to(m);
+    int flags = move_flags(m);
+    int n = 0;
+    if (flags == CASTLE_RIGHT || flags == CASTLE_LEFT) {
+        str[n++] = 'O';
+        str[n++] = '-';
+        str[n++] = 'O';
+        if (flags == CASTLE_LEFT) {
+            str[n++] = '-';
+            str[n++] = 'O';
+        }
+    } else {
+        int piece = piece_on(b, (uint64_t) 1 << from, side_to_move(b));
+        if (piece == PAWN) {
+            if (is_capture(m)) str[n++] = file_names[from % 8];
+        } else {
+            str[n++] = piece_names[WHITE][piece];
+            // Name the file, else the rank, else both if another such piece can reach to.
+            move_list list;
+            generate_moves(b, &list);
+            int ambiguous = 0, same_file = 0, same_rank = 0;
+            for (int i = 0; i < list.count; i++) {
+                int other = move_from(list.moves[i]);
+                if (other == from || move_to(list.moves[i]) != to) continue;
+                if (piece_on(b, (uint64_t) 1 << other, side_to_move(b)) != piece) continue;
+                ambiguous = 1;
+                if (other % 8 == from % 8) same_file = 1;
+                if (other / 8 == from / 8) same_rank = 1;
+            }
+            if (ambiguous && (!same_file || same_rank)) str[n++] = file_names[from % 8];
+            if (ambiguous && same_file) str[n++] = rank_names[from / 8];
+        }
+        if (is_capture(m)) str[n++] = 'x';
+        str[n++] = file_names[to % 8];
+        str[n++] = rank_names[to / 8];
+        if (is_promotion(m)) {
+            str[n++] = '=';
+            str[n++] = piece_names[WHITE][promotion_piece(m)];
+        }
+    }
+
+    move_undo undo;
+    do_move(b, m, &undo);
+    if (in_check(b, side_to_move(b))) {
+        move_list replies;
+        str[n++] = (generate_moves(b, &replies)) ? '+': '#';
+    }
+    undo_move(b, m, &undo);
+    str[n] = '\0';
+}
+
+/*
+ * Copy of perft function with print at first level. Allows analysis of number 
+ * of nodes generated after the first move. 
+*/
+uint64_t perft_divide(board* b, int depth) {
+    if (!depth) return 1;
+    uint64_t nodes = 0;
+    move_list list;
+    generate_moves(b, &list);
+
+    move_undo undo;
+    for (int i = 0; i < list.count; i++) {
+        char move_str[6];
+        move_to_uci(list.moves[i], move_str);
+        do_move(b, list.moves[i], &undo);
+        uint64_t new_nodes = perft(b, depth - 1);
+        undo_move(b, list.moves[i], &undo);
+        printf("%s %" PRIu64 "\n", move_str, new_nodes);
+        nodes += new_nodes;
+    }
+
+    return nodes;
+}
+
+/*
+ * Perft testing function. Evaluates entire search tree with no pruning and counts 
+ * number of nodes generated. 
+*/
+uint64_t perft(board* b, int depth) {
+    if (!depth) return 1;
+    // Leaf nodes are only counted, so skip making each last move.
+    if (depth == 1) return count_legal_moves(b);
+    uint64_t nodes = 0;
+    move_list list;
+    generate_moves(b, &list);
+
+    move_undo undo;
+    for (int i = 0; i < list.count; i++) {
+        do_move(b, list.moves[i], &undo);
+        nodes += perft(b, depth - 1);
+        undo_move(b, list.moves[i], &undo);
+    }
+
+    return nodes;
+}
+
+/*
+ * Perft transposition table. Caches node counts by position key and depth 
+ * so transposed subtrees are only walked once. Each entry is 16 bytes with 
+ * the depth packed into the low byte of data and the node count above it, 
+ * so a bucket of four entries fills exactly one 64 byte cache line.
+ * Entries store key XOR data so threads can share the table without locks; 
+ * an entry torn by concurrent writes fails the XOR check and reads as a miss.
+*/
+#define PERFT_BUCKET_SIZE 4
+
+typedef struct perft_entry {
+    uint64_t key;
+    uint64_t data;
+} perft_entry;
+
+typedef struct perft_bucket {
+    perft_entry entries[PERFT_BUCKET_SIZE];
+} perft_bucket;
+
+typedef struct perft_table {
+    perft_bucket* buckets;
+    uint64_t mask;
+    uint64_t hits;
+    uint64_t misses;
+    // Stores which evicted a different position.
+    uint64_t collisions;
+} perft_table;
+
+/*
+ * Allocates table using at most mb megabytes, rounded down to a power of two number of buckets.
+*/
+perft_table* perft_table_alloc(size_t mb) {
+    size_t count = 1;
+    while (count * 2 * sizeof(perft_bucket) <= mb * 1024 * 1024) {
+        count *= 2;
+    }
+    perft_table* t = malloc(sizeof(perft_table));
+    if (!t) {
+        printf("Perft table failed to allocate\n");
+        return NULL;
+    }
+    t->buckets = aligned_alloc(64, count * sizeof(perft_bucket));
+    if (!t->buckets) {
+        printf("Perft table failed to allocate\n");
+        free(t);
+        return NULL;
+    }
+    memset(t->buckets, 0, count * sizeof(perft_bucket));
+    t->mask = count - 1;
+    t->hits = 0;
+    t->misses = 0;
+    t->collisions = 0;
+    return t;
+}
+
+void perft_table_delete(perft_table* t) {
+    free(t->buckets);
+    free(t);
+}
+
+/*
+ * Returns true and sets nodes if a count for key at depth is stored.
+*/
+int perft_table_probe(perft_table* t, uint64_t key, int depth, uint64_t* nodes) {
+    perft_entry* entries = t->buckets[key & t->mask].entries;
+    for (int i = 0; i < PERFT_BUCKET_SIZE; i++) {
+        uint64_t data = __atomic_load_n(&entries[i].data, __ATOMIC_RELAXED);
+        uint64_t entry_key = __atomic_load_n(&entries[i].key, __ATOMIC_RELAXED) ^ data;
+        if (entry_key == key && (data & 0xFF) == (uint64_t) depth) {
+            __atomic_fetch_add(&t->hits, 1, __ATOMIC_RELAXED);
+            *nodes = data >> 8;
+            return 1;
+        }
+    }
+    __atomic_fetch_add(&t->misses, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/*
+ * Stores node count in an empty slot if there is one, otherwise replaces the 
+ * shallowest entry as it is the cheapest to recompute.
+*/
+void perft_table_store(perft_table* t, uint64_t key, int depth, uint64_t nodes) {
+    perft_entry* entries = t->buckets[key & t->mask].entries;
+    perft_entry* replace = &entries[0];
+    uint64_t replace_data = __atomic_load_n(&entries[0].data, __ATOMIC_RELAXED);
+    for (int i = 0; i < PERFT_BUCKET_SIZE; i++) {
+        uint64_t data = __atomic_load_n(&entries[i].data, __ATOMIC_RELAXED);
+        if (!data) {
+            replace = &entries[i];
+            replace_data = data;
+            break;
+        }
+        if ((data & 0xFF) < (replace_data & 0xFF)) {
+            replace = &entries[i];
+            replace_data = data;
+        }
+    }
+    if (replace_data && (__atomic_load_n(&replace->key, __ATOMIC_RELAXED) ^ replace_data) != key) {
+        __atomic_fetch_add(&t->collisions, 1, __ATOMIC_RELAXED);
+    }
+    uint64_t data = (nodes << 8) | depth;
+    __atomic_store_n(&replace->key, key ^ data, __ATOMIC_RELAXED);
+    __atomic_store_n(&replace->data, data, __ATOMIC_RELAXED);
+}
+
+void perft_table_report(perft_table* t) {
+    uint64_t probes = t->hits + t->misses;
+    printf("Perft table: %" PRIu64 " hits, %" PRIu64 " misses, %" PRIu64 " collisions, %.1f%% hit rate\n", \
+           t->hits, t->misses, t->collisions, (probes) ? 100.0 * t->hits / probes: 0.0);
+}
+
+/*
+ * Perft using table to skip subtrees already counted. Depth 1 nodes are
+ * counted directly as storing them costs more than generating them.
+*/
+uint64_t perft_hashed(board* b, int depth, perft_table* t) {
+    if (depth < 2) return perft(b, depth);
+    uint64_t nodes = 0;
+    if (perft_table_probe(t, b->key, depth, &nodes)) return nodes;
+
+    move_list list;
+    generate_moves(b, &list);
+
+    move_undo undo;
+    for (int i = 0; i < list.count; i++) {
+        do_move(b, list.moves[i], &undo);
+        nodes += perft_hashed(b, depth - 1, t);
+        undo_move(b, list.moves[i], &undo);
+    }
+
+    perft_table_store(t, b->key, depth, nodes);
+    return nodes;
+}
+
+/*
+ * Parallel perft. Root moves become tasks spread over per worker deques. A 
+ * task is the line of moves from the root, so each worker replays it on its 
+ * own board copy. Tasks with enough depth left are split into one task per 
+ * child move, which keeps idle workers fed near the end of a run. Owners 
+ * push and pop at the tail of their deque while idle workers steal from the 
+ * head of others.
+*/
+#define PERFT_MAX_SPLIT 3
+
+// Tasks with at least this many plies left are split into child tasks.
+int perft_split_depth = 5;
+
+typedef struct perft_task {
+    move path[PERFT_MAX_SPLIT];
+    int length;
+    int root;
+} perft_task;
+
+typedef struct perft_deque {
+    perft_task* tasks;
+    int head;
+    int tail;
+    int capacity;
+    pthread_mutex_t lock;
+} perft_deque;
+
+typedef struct perft_pool perft_pool;
+
+typedef struct perft_worker {
+    perft_pool* pool;
+    perft_deque deque;
+    int id;
+    pthread_t thread;
+} perft_worker;
+
+struct perft_pool {
+    board* root;
+    int depth;
+    perft_table* table;
+    perft_worker* workers;
+    int threads;
+    // Tasks queued or running. Workers stop once this reaches zero.
+    int pending;
+    uint64_t root_nodes[MAX_MOVES];
+};
+
+void perft_deque_push(perft_deque* d, perft_task* task) {
+    pthread_mutex_lock(&d->lock);
+    if (d->tail == d->capacity) {
+        d->capacity = (d->capacity) ? d->capacity * 2: 64;
+        d->tasks = realloc(d->tasks, d->capacity * sizeof(perft_task));
+        if (!d->tasks) {
+            printf("Perft deque failed to allocate\n");
+            exit(1);
+        }
+    }
+    d->tasks[d->tail++] = *task;
+    pthread_mutex_unlock(&d->lock);
+}
+
+/*
+ * Owner end. Newest tasks are smallest so popping them first keeps the deque short.
+*/
+int perft_deque_pop(perft_deque* d, perft_task* task) {
+    int found = 0;
+    pthread_mutex_lock(&d->lock);
+    if (d->tail > d->head) {
+        *task = d->tasks[--d->tail];
+        found = 1;
+    }
+    if (d->tail == d->head) {
+        d->head = 0;
+        d->tail = 0;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return found;
+}
+
+/*
+ * Thief end. Oldest tasks are the largest so a steal takes the most work.
+*/
+int perft_deque_steal(perft_deque* d, perft_task* task) {
+    int found = 0;
+    pthread_mutex_lock(&d->lock);
+    if (d->tail > d->head) {
+        *task = d->tasks[d->head++];
+        found = 1;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return found;
+}
+
+void perft_run_task(perft_worker* w, board* b, perft_task* task) {
+    perft_pool* pool = w->pool;
+    move_undo undo[PERFT_MAX_SPLIT];
+    for (int i = 0; i < task->length; i++) {
+        do_move(b, task->path[i], &undo[i]);
+    }
+
+    int depth = pool->depth - task->length;
+    if (depth >= perft_split_depth && task->length < PERFT_MAX_SPLIT) {
+        move_list list;
+        generate_moves(b, &list);
+        for (int i = 0; i < list.count; i++) {
+            perft_task child = *task;
+            child.path[child.length++] = list.moves[i];
+            __atomic_fetch_add(&pool->pending, 1, __ATOMIC_ACQ_REL);
+            perft_deque_push(&w->deque, &child);
+        }
+    } else {
+        uint64_t nodes = (pool->table) ? perft_hashed(b, depth, pool->table): perft(b, depth);
+        __atomic_fetch_add(&pool->root_nodes[task->root], nodes, __ATOMIC_RELAXED);
+    }
+
+    for (int i = task->length - 1; i >= 0; i--) {
+        undo_move(b, task->path[i], &undo[i]);
+    }
+}
+
+void* perft_worker_loop(void* arg) {
+    perft_worker* w = arg;
+    perft_pool* pool = w->pool;
+    board b;
+    board_copy(&b, pool->root);
+
+    perft_task task;
+    while (__atomic_load_n(&pool->pending, __ATOMIC_ACQUIRE)) {
+        int found = perft_deque_pop(&w->deque, &task);
+        for (int i = 1; !found && i < pool->threads; i++) {
+            found = perft_deque_steal(&pool->workers[(w->id + i) % pool->threads].deque, &task);
+        }
+        if (!found) {
+            sched_yield();
+            continue;
+        }
+        perft_run_task(w, &b, &task);
+        __atomic_fetch_sub(&pool->pending, 1, __ATOMIC_ACQ_REL);
+    }
+    return NULL;
+}
+
+/*
+ * Runs perft over threads workers and fills root_nodes with the count under
+ * each legal root move, in the order they are listed in moves. Shares table
+ * between workers if given. Returns number of legal root moves.
+*/
+int perft_parallel_run(board* b, int depth, int threads, perft_table* t, move_list* moves, uint64_t* root_nodes) {
+    perft_pool pool;
+    pool.root = b;
+    pool.depth = depth;
+    pool.table = t;
+    pool.threads = (threads > 0) ? threads: 1;
+    pool.pending = 0;
+    pool.workers = calloc(pool.threads, sizeof(perft_worker));
+    if (!pool.workers) {
+        printf("Perft workers failed to allocate\n");
+        return 0;
+    }
+
+    generate_moves(b, moves);
+
+    for (int i = 0; i < pool.threads; i++) {
+        pool.workers[i].pool = &pool;
+        pool.workers[i].id = i;
+        pthread_mutex_init(&pool.workers[i].deque.lock, NULL);
+    }
+    for (int i = 0; i < moves->count; i++) {
+        perft_task task = { .path = { moves->moves[i] }, .length = 1, .root = i };
+        pool.root_nodes[i] = 0;
+        pool.pending++;
+        perft_deque_push(&pool.workers[i % pool.threads].deque, &task);
+    }
+
+    for (int i = 0; i < pool.threads; i++) {
+        pthread_create(&pool.workers[i].thread, NULL, perft_worker_loop, &pool.workers[i]);
+    }
+    for (int i = 0; i < pool.threads; i++) {
+        pthread_join(pool.workers[i].thread, NULL);
+        pthread_mutex_destroy(&pool.workers[i].deque.lock);
+        free(pool.workers[i].deque.tasks);
+    }
+    free(pool.workers);
+
+    for (int i = 0; i < moves->count; i++) {
+        root_nodes[i] = pool.root_nodes[i];
+    }
+    return moves->count;
+}
+
+uint64_t perft_parallel(board* b, int depth, int threads, perft_table* t) {
+    if (depth < 2) return perft(b, depth);
+    move_list moves;
+    uint64_t root_nodes[MAX_MOVES];
+    uint64_t nodes = 0;
+    int count = perft_parallel_run(b, depth, threads, t, &moves, root_nodes);
+    for (int i = 0; i < count; i++) {
+        nodes += root_nodes[i];
+    }
+    return nodes;
+}
+
+/*
+ * Parallel perft_divide. Prints the same per root move breakdown once all workers finish.
+*/
+uint64_t perft_divide_parallel(board* b, int depth, int threads, perft_table* t) {
+    if (depth < 2) return perft_divide(b, depth);
+    move_list moves;
+    uint64_t root_nodes[MAX_MOVES];
+    uint64_t nodes = 0;
+    int count = perft_parallel_run(b, depth, threads, t, &moves, root_nodes);
+    for (int i = 0; i < count; i++) {
+        char move_str[6];
+        move_to_uci(moves.moves[i], move_str);
+        printf("%s %" PRIu64 "\n", move_str, root_nodes[i]);
+        nodes += root_nodes[i];
+    }
+    return nodes;
+}
+
+/*
+ * Search. Iterative deepening principal variation search: each iteration 
+ * searches the first move with a full window and the rest with a null 
+ * window around alpha, re-searching only moves which beat it. Leaves are 
+ * resolved by a quiescence search over captures and promotions so scores 
+ * are only taken from quiet positions. Scores are in centipawns from the 
+ * side to move's view.
+*/
+#define MAX_PLY 128
+#define INFINITE_SCORE 32000
+#define MATE_SCORE 31000
+// Scores beyond this are mates, the distance to mate is MATE_SCORE minus the score.
+#define MATE_BOUND (MATE_SCORE - MAX_PLY)
+
+// The king's value only matters to SEE, where it makes capturing into a defended square a loss.
+int piece_values[6] = {100, 320, 330, 500, 900, 20000};
+
+/*
+ * Adds the pawn structure terms, cached in pawns if not NULL, to the 
+ * incremental middlegame and endgame totals, blends them by game phase and 
+ * returns the score from the side to move's view. Promotions can push the 
+ * phase past its opening value so it is capped.
+*/
+int evaluate(board* b, pawn_table* pawns) {
+    int pawn_mg, pawn_eg;
+    pawn_eval(b, pawns, &pawn_mg, &pawn_eg);
+    int phase = (b->phase < PHASE_MAX) ? b->phase: PHASE_MAX;
+    int score = ((b->mg_score + pawn_mg) * phase + (b->eg_score + pawn_eg) * (PHASE_MAX - phase)) / PHASE_MAX;
+    return (side_to_move(b)) ? score: -score;
+}
+
+/*
+ * Search transposition table. Each 16 byte entry holds the key XOR data and 
+ * data packing the best move (bits 0-15), score (16-31), depth (32-39), 
+ * bound (40-41) and the search generation (42-47), four entries to a 64 byte 
+ * cache line. As with the perft table the XOR lets threads share it without 
+ * locks since a torn entry fails the key check. Entries left from older 
+ * searches are replaced first, then the shallowest.
+*/
+#define TT_BUCKET_SIZE 4
+#define TT_GENERATIONS 64
+
+enum { TT_UPPER = 1, TT_LOWER = 2, TT_EXACT = 3 };
+
+typedef struct tt_entry {
+    uint64_t key;
+    uint64_t data;
+} tt_entry;
+
+typedef struct tt_bucket {
+    tt_entry entries[TT_BUCKET_SIZE];
+} tt_bucket;
+
+typedef struct tt_table {
+    tt_bucket* buckets;
+    uint64_t mask;
+    int generation;
+} tt_table;
+
+/*
+ * Replaces buckets of t with a cleared table of at most mb megabytes, 
+ * rounded down to a power of two number of buckets. Must not be called 
+ * while a search is using t. Returns 0 and leaves t unchanged on failure.
+*/
+int tt_resize(tt_table* t, size_t mb) {
+    size_t count = 1;
+    while (count * 2 * sizeof(tt_bucket) <= mb * 1024 * 1024) {
+        count *= 2;
+    }
+    tt_bucket* buckets = aligned_alloc(64, count * sizeof(tt_bucket));
+    if (!buckets) {
+        printf("Transposition table failed to allocate\n");
+        return 0;
+    }
+    memset(buckets, 0, count * sizeof(tt_bucket));
+    free(t->buckets);
+    t->buckets = buckets;
+    t->mask = count - 1;
+    t->generation = 0;
+    return 1;
+}
+
+tt_table* tt_alloc(size_t mb) {
+    tt_table* t = malloc(sizeof(tt_table));
+    if (!t) {
+        printf("Transposition table failed to allocate\n");
+        return NULL;
+    }
+    t->buckets = NULL;
+    if (!tt_resize(t, mb)) {
+        free(t);
+        return NULL;
+    }
+    return t;
+}
+
+void tt_delete(tt_table* t) {
+    free(t->buckets);
+    free(t);
+}
+
+void tt_clear(tt_table* t) {
+    memset(t->buckets, 0, (t->mask + 1) * sizeof(tt_bucket));
+    t->generation = 0;
+}
+
+/*
+ * Called at the start of each search so entries from earlier ones age.
+*/
+void tt_new_search(tt_table* t) {
+    t->generation = (t->generation + 1) % TT_GENERATIONS;
+}
+
+int tt_entry_depth(uint64_t data) {
+    return (data >> 32) & 0xFF;
+}
+
+int tt_entry_age(tt_table* t, uint64_t data) {
+    return (t->generation - (int) ((data >> 42) & 0x3F) + TT_GENERATIONS) % TT_GENERATIONS;
+}
+
+/*
+ * Mate scores are stored relative to the node rather than the root so they 
+ * stay valid when the position is reached at another ply.
+*/
+int tt_score_to(int score, int ply) {
+    if (score > MATE_BOUND) return score + ply;
+    if (score < -MATE_BOUND) return score - ply;
+    return score;
+}
+
+int tt_score_from(int score, int ply) {
+    if (score > MATE_BOUND) return score - ply;
+    if (score < -MATE_BOUND) return score + ply;
+    return score;
+}
+
+/*
+ * Returns true and fills the out params if key is stored. The score is 
+ * adjusted for mates found at ply.
+*/
+int tt_probe(tt_table* t, uint64_t key, int ply, move* m, int* score, int* depth, int* bound) {
+    tt_entry* entries = t->buckets[key & t->mask].entries;
+    for (int i = 0; i < TT_BUCKET_SIZE; i++) {
+        uint64_t data = __atomic_load_n(&entries[i].data, __ATOMIC_RELAXED);
+        if ((__atomic_load_n(&entries[i].key, __ATOMIC_RELAXED) ^ data) == key && data) {
+            *m = data & 0xFFFF;
+            *score = tt_score_from((int16_t) (data >> 16), ply);
+            *depth = tt_entry_depth(data);
+            *bound = (data >> 40) & 3;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Stores over the entry for key if present, keeping its move when m is 0. 
+ * Otherwise replaces the entry with the lowest depth less eight plies per 
+ * generation of age, so stale deep entries eventually give way.
+*/
+void tt_store(tt_table* t, uint64_t key, int ply, move m, int score, int depth, int bound) {
+    tt_entry* entries = t->buckets[key & t->mask].entries;
+    tt_entry* replace = NULL;
+    int replace_value = INT_MAX;
+    for (int i = 0; i < TT_BUCKET_SIZE; i++) {
+        uint64_t data = __atomic_load_n(&entries[i].data, __ATOMIC_RELAXED);
+        if ((__atomic_load_n(&entries[i].key, __ATOMIC_RELAXED) ^ data) == key && data) {
+            if (!m) m = data & 0xFFFF;
+            replace = &entries[i];
+            break;
+        }
+        int value = (data) ? tt_entry_depth(data) - 8 * tt_entry_age(t, data): INT_MIN;
+        if (value < replace_value) {
+            replace = &entries[i];
+            replace_value = value;
+        }
+    }
+    uint64_t data = (uint64_t) m | (uint64_t) (uint16_t) tt_score_to(score, ply) << 16 \
+                  | (uint64_t) depth << 32 | (uint64_t) bound << 40 | (uint64_t) t->generation << 42;
+    __atomic_store_n(&replace->key, key ^ data, __ATOMIC_RELAXED);
+    __atomic_store_n(&replace->data, data, __ATOMIC_RELAXED);
+}
+
+/*
+ * Permille of entries written by the current search, sampled from the first 
+ * thousand buckets or fewer, as reported by UCI hashfull.
+*/
+int tt_hashfull(tt_table* t) {
+    uint64_t buckets = (t->mask + 1 < 1000) ? t->mask + 1: 1000;
+    int used = 0;
+    for (uint64_t i = 0; i < buckets; i++) {
+        for (int j = 0; j < TT_BUCKET_SIZE; j++) {
+            uint64_t data = __atomic_load_n(&t->buckets[i].entries[j].data, __ATOMIC_RELAXED);
+            used += data && !tt_entry_age(t, data);
+        }
+    }
+    return used * 1000 / (buckets * TT_BUCKET_SIZE);
+}
+
+/*
+ * Selective search features. Each can be switched off at runtime to measure 
+ * its effect on node counts and time to depth, eg. with search_bench. The 
+ * UCI front end exposes them as check options and search_bench as bench.
+ * - null_move: skip a turn and prune if a reduced search still fails high, 
+ *   verified at high depth by a reduced search without null moves
+ * - lmr: search late quiet moves to a depth reduced by a log table and 
+ *   re-search those which beat alpha
+ * - futility: skip quiet moves near the leaves when the static evaluation 
+ *   plus a margin cannot reach alpha
+ * - reverse_futility: return near the leaves when the static evaluation 
+ *   less a margin still beats beta
+ * - razoring: drop into quiescence near the leaves when the static 
+ *   evaluation is far below alpha
+ * - check_extensions: search moves which give check one ply deeper
+*/
+typedef struct search_options {
+    int null_move;
+    int lmr;
+    int futility;
+    int reverse_futility;
+    int razoring;
+    int check_extensions;
+} search_options;
+
+search_options options = {1, 1, 1, 1, 1, 1};
+
+#define NULL_VERIFY_DEPTH 8
+#define FUTILITY_DEPTH 3
+#define RAZOR_DEPTH 2
+
+int futility_margin[FUTILITY_DEPTH + 1] = {0, 150, 300, 450};
+int razor_margin[RAZOR_DEPTH + 1] = {0, 300, 500};
+
+// Plies to reduce a late move by, indexed by depth then move number.
+int reductions[64][64];
+
+/*
+ * Natural log from the series ln(x) = 2 * atanh((x - 1) / (x + 1)). Only 
+ * used to fill tables at startup so libm is not needed.
+*/
+double table_log(double x) {
+    double z = (x - 1) / (x + 1);
+    double term = z;
+    double sum = 0;
+    for (int k = 1; k < 800; k += 2) {
+        sum += term / k;
+        term *= z * z;
+    }
+    return 2 * sum;
+}
+
+void init_search() {
+    for (int depth = 1; depth < 64; depth++) {
+        for (int count = 1; count < 64; count++) {
+            reductions[depth][count] = (int) (0.75 + table_log(depth) * table_log(count) / 2.25);
+        }
+    }
+}
+
+/*
+ * Any limit left at 0 is not applied. A search with no limits runs until 
+ * search_stop is called from another thread.
+*/
+typedef struct search_limits {
+    int depth;
+    uint64_t nodes;
+    // Milliseconds.
+    int64_t movetime;
+    // Keep the result back until search_stop() is called, as for UCI go infinite.
+    int infinite;
+} search_limits;
+
+#define MAX_HISTORY 256
+
+/*
+ * Keys of the positions played in the game before the search root, oldest 
+ * first, so the search sees repetitions of them. Positions before the last 
+ * capture or pawn move can never repeat so need not be kept.
+*/
+typedef struct game_history {
+    uint64_t keys[MAX_HISTORY];
+    int count;
+} game_history;
+
+/*
+ * Records the key of b before a move is played from it. Forgets the 
+ * history after an irreversible move and the oldest key when full.
+*/
+void history_push(game_history* h, board* b) {
+    if (!b->halfmove) h->count = 0;
+    if (h->count == MAX_HISTORY) {
+        memmove(h->keys, h->keys + 1, (MAX_HISTORY - 1) * sizeof(uint64_t));
+        h->count--;
+    }
+    h->keys[h->count++] = b->key;
+}
+
+/*
+ * Staged move picker. Moves come out in the order most likely to cause a 
+ * cutoff, and each stage is only generated once the earlier ones failed to:
+ * - the hash move
+ * - captures and promotions which do not lose material by static exchange, 
+ *   most valuable victim and least valuable attacker first
+ * - the two killer moves of the ply, quiet moves which caused cutoffs in 
+ *   sibling nodes
+ * - the countermove, the quiet move which last refuted the opponent's move
+ * - the remaining quiet moves by butterfly history
+ * - the losing captures, which quiescence search skips entirely
+ * Hash, killer and countermoves come from tables so are checked with 
+ * move_valid before use and skipped when met again in later stages.
+*/
+enum { STAGE_HASH, STAGE_CAPTURES, STAGE_KILLER_1, STAGE_KILLER_2, STAGE_COUNTER, STAGE_QUIETS, \
+       STAGE_BAD_CAPTURES, STAGE_DONE };
+
+char* stage_names[STAGE_DONE] = {"hash", "captures", "killer 1", "killer 2", "counter", "quiets", "bad caps"};
+
+typedef struct move_picker {
+    move_list list;
+    int scores[MAX_MOVES];
+    int index;
+    // Captures losing material by static exchange, held back until after the quiets.
+    move bad_captures[MAX_MOVES];
+    int bad_count;
+    int bad_index;
+    int generated;
+    int stage;
+    // Stage the last returned move came from.
+    int move_stage;
+    int captures_only;
+    move hash_move;
+    move killers[2];
+    move counter;
+} move_picker;
+
+/*
+ * State of one search thread. Each thread searches its own copy of the 
+ * root board and keeps its own move ordering tables. The first thread of a 
+ * search is the main thread which polls the limits and owns the stop flag 
+ * every thread reads.
+*/
+typedef struct search_info search_info;
+
+struct search_info {
+    board board;
+    board* b;
+    // Shared transposition table, NULL to search without one.
+    tt_table* tt;
+    search_info* main;
+    int thread_id;
+    int thread_count;
+    search_limits limits;
+    int64_t start;
+    uint64_t nodes;
+    // Only the main thread's flag is used. Set once a limit is hit or by another thread to abort.
+    int stop;
+    int ply;
+    // Keys of the game positions before the root then of the current line, 
+    // for repetition detection. The root is at keys[history_count].
+    uint64_t keys[MAX_HISTORY + MAX_PLY];
+    int history_count;
+    pawn_table pawns;
+    // Move ordering tables, see move_picker.
+    move killers[MAX_PLY][2];
+    move counter_moves[64][64];
+    int history[2][64][64];
+    // Move made at each ply of the current line, 0 for none or a null move.
+    move path[MAX_PLY];
+    // Set while verifying a null move cutoff so no further null moves are tried.
+    int null_verifying;
+    // Moves tried and beta cutoffs caused per picker stage.
+    uint64_t stage_moves[STAGE_DONE];
+    uint64_t stage_cutoffs[STAGE_DONE];
+    // Triangular principal variation table, pv[ply] holds the line from ply.
+    move pv[MAX_PLY][MAX_PLY];
+    int pv_length[MAX_PLY];
+    // Result of the last completed iteration.
+    int depth;
+    int score;
+    move best_move;
+};
+
+/*
+ * Allocates infos for threads search threads with empty pawn tables. Every 
+ * info points at the first as main so search_stop is safe before a search 
+ * has started.
+*/
+search_info* search_info_alloc(int threads) {
+    search_info* s = calloc(threads, sizeof(search_info));
+    if (!s) {
+        printf("Search failed to allocate\n");
+        return NULL;
+    }
+    for (int i = 0; i < threads; i++) {
+        s[i].main = s;
+    }
+    return s;
+}
+
+void search_info_delete(search_info* s) {
+    free(s);
+}
+
+int64_t time_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void search_stop(search_info* s) {
+    __atomic_store_n(&s->main->stop, 1, __ATOMIC_RELAXED);
+}
+
+int search_aborted(search_info* s) {
+    return __atomic_load_n(&s->main->stop, __ATOMIC_RELAXED);
+}
+
+/*
+ * Counts a node for thread s. Only the owning thread writes its count, so a 
+ * relaxed load and store is enough and compiles to a plain increment, while 
+ * search_nodes can read the counts from other threads without a data race.
+*/
+void search_count_node(search_info* s) {
+    __atomic_store_n(&s->nodes, __atomic_load_n(&s->nodes, __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Nodes searched by all threads. s must be the main thread.
+*/
+uint64_t search_nodes(search_info* s) {
+    uint64_t nodes = 0;
+    for (int i = 0; i < s->thread_count; i++) {
+        nodes += __atomic_load_n(&s[i].nodes, __ATOMIC_RELAXED);
+    }
+    return nodes;
+}
+
+/*
+ * The main thread polls the limits every 2048 nodes so the clock is not 
+ * read at every node. movetime and infinite may be changed by 
+ * search_ponderhit while the search runs.
+*/
+int search_stopped(search_info* s) {
+    if (s == s->main && !(s->nodes & 2047)) {
+        int64_t movetime = __atomic_load_n(&s->limits.movetime, __ATOMIC_RELAXED);
+        if (s->limits.nodes && search_nodes(s) >= s->limits.nodes) search_stop(s);
+        if (movetime && time_ms() - s->start >= movetime) search_stop(s);
+    }
+    return search_aborted(s);
+}
+
+/*
+ * Turns the running pondering search of main thread s, started with 
+ * infinite limits, into one bound by the movetime and infinite of limits. 
+ * movetime counts from now, when the opponent played the expected move. 
+ * Called from another thread.
+*/
+void search_ponderhit(search_info* s, search_limits* limits) {
+    int64_t movetime = (limits->movetime) ? time_ms() - s->start + limits->movetime: 0;
+    __atomic_store_n(&s->limits.movetime, movetime, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->limits.infinite, limits->infinite, __ATOMIC_RELAXED);
+}
+
+/*
+ * Returns value of the piece taken by m, 0 for quiet moves.
+*/
+int captured_value(board* b, move m) {
+    if (move_flags(m) == EN_PASSANT) return piece_values[PAWN];
+    if (!is_capture(m)) return 0;
+    return piece_values[piece_on(b, (uint64_t) 1 << move_to(m), !side_to_move(b))];
+}
+
+/*
+ * Static exchange evaluation. Returns the material m wins or loses once 
+ * both sides have made every profitable recapture on its target square, 
+ * always recapturing with their least valuable attacker. Attackers 
+ * uncovered behind a capturing slider join the exchange.
+*/
+int see(board* b, move m) {
+    int flags = move_flags(m);
+    if (flags == CASTLE_RIGHT || flags == CASTLE_LEFT) return 0;
+    int to = move_to(m);
+    uint64_t from = (uint64_t) 1 << move_from(m);
+    uint64_t occupied = (b->colors[WHITE] | b->colors[BLACK]) ^ from;
+    if (flags == EN_PASSANT) {
+        occupied ^= (side_to_move(b)) ? (uint64_t) 1 << (to - 8): (uint64_t) 1 << (to + 8);
+    }
+    uint64_t rooks = b->pieces[ROOK] | b->pieces[QUEEN];
+    uint64_t bishops = b->pieces[BISHOP] | b->pieces[QUEEN];
+
+    // gain[d] is what the side making capture d wins if the exchange stops after it.
+    int gain[32];
+    int d = 0;
+    int piece = piece_on(b, from, side_to_move(b));
+    gain[0] = captured_value(b, m);
+    if (is_promotion(m)) {
+        piece = promotion_piece(m);
+        gain[0] += piece_values[piece] - piece_values[PAWN];
+    }
+    uint64_t attackers = attackers_to(b, to, occupied) & occupied;
+    int side = !side_to_move(b);
+    while (d < 31) {
+        uint64_t own = attackers & ((side) ? b->colors[WHITE]: b->colors[BLACK]);
+        if (!own) break;
+        int next = PAWN;
+        while (!(own & piece_board(b, side, next))) next++;
+        d++;
+        gain[d] = piece_values[piece] - gain[d - 1];
+
+        uint64_t attacker = own & piece_board(b, side, next);
+        occupied ^= attacker & -attacker;
+        attackers |= (rook_attacks(to, occupied) & rooks) | (bishop_attacks(to, occupied) & bishops);
+        attackers &= occupied;
+        piece = next;
+        side = !side;
+    }
+    // Unwind, each side only recaptures when that beats stopping the exchange.
+    while (d) {
+        d--;
+        gain[d] = (-gain[d] < gain[d + 1]) ? -gain[d + 1]: gain[d];
+    }
+    return gain[0];
+}
+
+#define HISTORY_MAX 16384
+
+void picker_init(move_picker* p, search_info* s, move hash_move, int captures_only) {
+    p->stage = (captures_only) ? STAGE_CAPTURES: STAGE_HASH;
+    p->generated = 0;
+    p->bad_count = 0;
+    p->bad_index = 0;
+    p->captures_only = captures_only;
+    p->hash_move = hash_move;
+    if (captures_only) return;
+    int ply = s->ply;
+    move previous = (ply) ? s->path[ply - 1]: 0;
+    move counter = (previous) ? s->counter_moves[move_from(previous)][move_to(previous)]: 0;
+    // Killer and countermove slots are only kept when they name a quiet move no earlier stage returns.
+    p->killers[0] = s->killers[ply][0];
+    p->killers[1] = s->killers[ply][1];
+    p->counter = counter;
+    if (p->killers[0] == hash_move) p->killers[0] = 0;
+    if (p->killers[1] == hash_move || p->killers[1] == p->killers[0]) p->killers[1] = 0;
+    if (counter == hash_move || counter == p->killers[0] || counter == p->killers[1] \
+            || is_capture(counter) || is_promotion(counter)) {
+        p->counter = 0;
+    }
+}
+
+/*
+ * Returns highest scored move not yet returned from the generated list, 0 when exhausted.
+*/
+move pick_best(move_picker* p) {
+    if (p->index >= p->list.count) return 0;
+    int best = p->index;
+    for (int i = p->index + 1; i < p->list.count; i++) {
+        if (p->scores[i] > p->scores[best]) best = i;
+    }
+    move m = p->list.moves[best];
+    p->list.moves[best] = p->list.moves[p->index];
+    p->scores[best] = p->scores[p->index];
+    p->index++;
+    return m;
+}
+
+/*
+ * True if m was already returned by the hash, killer or counter stages.
+*/
+int picker_seen(move_picker* p, move m) {
+    if (m == p->hash_move) return 1;
+    if (p->stage != STAGE_QUIETS) return 0;
+    return m == p->killers[0] || m == p->killers[1] || m == p->counter;
+}
+
+/*
+ * Returns the next move to search, or 0 once all are exhausted.
+*/
+move next_move(move_picker* p, search_info* s) {
+    board* b = s->b;
+    move m;
+    while (p->stage != STAGE_DONE) {
+        p->move_stage = p->stage;
+        switch (p->stage) {
+            case STAGE_HASH:
+                p->stage++;
+                if (move_valid(b, p->hash_move)) return p->hash_move;
+                p->hash_move = 0;
+                break;
+            case STAGE_CAPTURES:
+                if (!p->generated) {
+                    generate(b, &p->list, GEN_CAPTURES);
+                    for (int i = 0; i < p->list.count; i++) {
+                        move c = p->list.moves[i];
+                        int attacker = piece_on(b, (uint64_t) 1 << move_from(c), side_to_move(b));
+                        p->scores[i] = captured_value(b, c) * 8 - piece_values[attacker] / 100 \
+                                     + ((is_promotion(c)) ? piece_values[promotion_piece(c)]: 0);
+                    }
+                    p->index = 0;
+                    p->generated = 1;
+                }
+                while ((m = pick_best(p))) {
+                    if (picker_seen(p, m)) continue;
+                    // Taking a piece worth at least the attacker can never lose material.
+                    int attacker = piece_on(b, (uint64_t) 1 << move_from(m), side_to_move(b));
+                    if (captured_value(b, m) < piece_values[attacker] && see(b, m) < 0) {
+                        p->bad_captures[p->bad_count++] = m;
+                        continue;
+                    }
+                    return m;
+                }
+                p->stage = (p->captures_only) ? STAGE_DONE: STAGE_KILLER_1;
+                p->generated = 0;
+                break;
+            case STAGE_KILLER_1:
+            case STAGE_KILLER_2:
+            case STAGE_COUNTER: {
+                move* slot = (p->stage == STAGE_COUNTER) ? &p->counter: &p->killers[p->stage - STAGE_KILLER_1];
+                p->stage++;
+                if (move_valid(b, *slot)) return *slot;
+                // Not returned so must not be skipped among the quiets.
+                *slot = 0;
+                break;
+            }
+            case STAGE_QUIETS:
+                if (!p->generated) {
+                    generate(b, &p->list, GEN_QUIETS);
+                    for (int i = 0; i < p->list.count; i++) {
+                        move q = p->list.moves[i];
+                        p->scores[i] = s->history[side_to_move(b)][move_from(q)][move_to(q)];
+                    }
+                    p->index = 0;
+                    p->generated = 1;
+                }
+                while ((m = pick_best(p))) {
+                    if (!picker_seen(p, m)) return m;
+                }
+                p->stage = STAGE_BAD_CAPTURES;
+                break;
+            case STAGE_BAD_CAPTURES:
+                if (p->bad_index < p->bad_count) return p->bad_captures[p->bad_index++];
+                p->stage = STAGE_DONE;
+                break;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Moves bonus toward history entry while keeping it within HISTORY_MAX.
+*/
+void update_history(int* entry, int bonus) {
+    *entry += bonus - *entry * abs(bonus) / HISTORY_MAX;
+}
+
+/*
+ * Rewards quiet move m which caused a cutoff at depth and penalises the 
+ * quiet moves tried before it.
+*/
+void update_quiet_stats(search_info* s, move m, int depth, move* quiets, int quiet_count) {
+    int ply = s->ply;
+    int side = side_to_move(s->b);
+    int bonus = (depth * depth < HISTORY_MAX) ? depth * depth: HISTORY_MAX;
+    update_history(&s->history[side][move_from(m)][move_to(m)], bonus);
+    for (int i = 0; i < quiet_count; i++) {
+        update_history(&s->history[side][move_from(quiets[i])][move_to(quiets[i])], -bonus);
+    }
+    if (s->killers[ply][0] != m) {
+        s->killers[ply][1] = s->killers[ply][0];
+        s->killers[ply][0] = m;
+    }
+    move previous = (ply) ? s->path[ply - 1]: 0;
+    if (previous) {
+        s->counter_moves[move_from(previous)][move_to(previous)] = m;
+    }
+}
+
+/*
+ * Prints how often moves from each picker stage caused a beta cutoff, over 
+ * all threads of the last search, as UCI info strings. s must be the main 
+ * thread.
+*/
+void picker_report(search_info* s) {
+    uint64_t moves[STAGE_DONE] = {0};
+    uint64_t cutoffs[STAGE_DONE] = {0};
+    uint64_t total = 0;
+    for (int i = 0; i < s->thread_count; i++) {
+        for (int stage = 0; stage < STAGE_DONE; stage++) {
+            moves[stage] += s[i].stage_moves[stage];
+            cutoffs[stage] += s[i].stage_cutoffs[stage];
+            total += s[i].stage_cutoffs[stage];
+        }
+    }
+    for (int stage = 0; stage < STAGE_DONE; stage++) {
+        printf("info string stage %-8s %10" PRIu64 " moves %10" PRIu64 " cutoffs %5.1f%% cutoff rate %5.1f%% of cutoffs\n", \
+               stage_names[stage], moves[stage], cutoffs[stage], (moves[stage]) ? 100.0 * cutoffs[stage] / moves[stage]: 0.0, \
+               (total) ? 100.0 * cutoffs[stage] / total: 0.0);
+    }
+}
+
+/*
+ * True if the current position already occurred on the line being searched 
+ * or in the game before it. Only positions with the same side to move and 
+ * no capture or pawn move since can match.
+*/
+int is_repetition(search_info* s) {
+    int current = s->history_count + s->ply;
+    int oldest = current - s->b->halfmove;
+    for (int i = current - 2; i >= 0 && i >= oldest; i -= 2) {
+        if (s->keys[i] == s->b->key) return 1;
+    }
+    return 0;
+}
+
+/*
+ * Searches captures and promotions only until the position is quiet. The 
+ * side to move may stand pat on the static evaluation instead of capturing.
+*/
+int quiescence(search_info* s, int alpha, int beta) {
+    search_count_node(s);
+    if (search_stopped(s)) return 0;
+    board* b = s->b;
+    int stand_pat = evaluate(b, &s->pawns);
+    if (stand_pat >= beta || s->ply >= MAX_PLY - 1) return stand_pat;
+    if (stand_pat > alpha) alpha = stand_pat;
+
+    move_picker picker;
+    picker_init(&picker, s, 0, 1);
+    move_undo undo;
+    move m;
+    while ((m = next_move(&picker, s))) {
+        do_move(b, m, &undo);
+        s->ply++;
+        int score = -quiescence(s, -beta, -alpha);
+        s->ply--;
+        undo_move(b, m, &undo);
+        if (search_aborted(s)) return 0;
+        if (score >= beta) return score;
+        if (score > alpha) alpha = score;
+    }
+    return alpha;
+}
+
+/*
+ * Principal variation search to depth plies below the current position. 
+ * Returns a score within (alpha, beta) if exact, otherwise a bound.
+*/
+int search_node(search_info* s, int alpha, int beta, int depth) {
+    board* b = s->b;
+    int ply = s->ply;
+    s->pv_length[ply] = 0;
+    // Repetitions and the fifty move rule are draws.
+    if (ply && (b->halfmove >= 100 || is_repetition(s))) return 0;
+    s->keys[s->history_count + ply] = b->key;
+    if (depth <= 0 || ply >= MAX_PLY - 1) return quiescence(s, alpha, beta);
+    search_count_node(s);
+    if (search_stopped(s)) return 0;
+
+    // Away from the principal variation a deep enough stored bound ends the search here.
+    move hash_move = 0;
+    int pv_node = beta - alpha > 1;
+    if (s->tt) {
+        int tt_score, tt_depth, tt_bound;
+        if (tt_probe(s->tt, b->key, ply, &hash_move, &tt_score, &tt_depth, &tt_bound) && ply && !pv_node \
+                && tt_depth >= depth && (tt_bound == TT_EXACT || (tt_bound == TT_LOWER && tt_score >= beta) \
+                || (tt_bound == TT_UPPER && tt_score <= alpha))) {
+            return tt_score;
+        }
+    }
+
+    int checked = in_check(b, side_to_move(b));
+    int eval = (checked) ? -INFINITE_SCORE: evaluate(b, &s->pawns);
+    move_undo undo;
+    if (!pv_node && !checked) {
+        if (options.reverse_futility && depth <= FUTILITY_DEPTH && eval - futility_margin[depth] >= beta) {
+            return eval;
+        }
+
+        if (options.razoring && depth <= RAZOR_DEPTH && eval + razor_margin[depth] < alpha) {
+            int score = quiescence(s, alpha - 1, alpha);
+            if (score < alpha) return score;
+        }
+
+        // Passing must still fail high, which is only trusted with pieces besides pawns left to avoid zugzwang.
+        uint64_t pieces = get_curr_side(b) & ~(piece_board(b, side_to_move(b), PAWN) | piece_board(b, side_to_move(b), KING));
+        if (options.null_move && depth >= 3 && eval >= beta && pieces && ply && s->path[ply - 1] \
+                && !s->null_verifying) {
+            int r = 3 + depth / 6;
+            s->path[ply] = 0;
+            do_null_move(b, &undo);
+            s->ply++;
+            int score = -search_node(s, -beta, -beta + 1, depth - 1 - r);
+            s->ply--;
+            undo_null_move(b, &undo);
+            if (search_aborted(s)) return 0;
+            if (score >= beta) {
+                if (score > MATE_BOUND) score = beta;
+                if (depth < NULL_VERIFY_DEPTH) return score;
+                s->null_verifying = 1;
+                int verified = search_node(s, beta - 1, beta, depth - r);
+                s->null_verifying = 0;
+                if (verified >= beta) return score;
+            }
+        }
+    }
+
+    // The hash move, or at the root the best move of the last iteration, is searched first.
+    move_picker picker;
+    picker_init(&picker, s, (!ply && s->best_move) ? s->best_move: hash_move, 0);
+
+    int best = -INFINITE_SCORE;
+    int original_alpha = alpha;
+    move best_move = 0;
+    int move_count = 0;
+    move quiets[64];
+    int quiet_count = 0;
+    move m;
+    while ((m = next_move(&picker, s))) {
+        s->stage_moves[picker.move_stage]++;
+        s->path[ply] = m;
+        do_move(b, m, &undo);
+        move_count++;
+        int quiet = !is_capture(m) && !is_promotion(m);
+        int gives_check = in_check(b, side_to_move(b));
+
+        if (options.futility && !pv_node && !checked && !gives_check && quiet && move_count > 1 \
+                && depth <= FUTILITY_DEPTH && eval + futility_margin[depth] <= alpha) {
+            undo_move(b, m, &undo);
+            if (eval + futility_margin[depth] > best) best = eval + futility_margin[depth];
+            continue;
+        }
+
+        int new_depth = depth - 1 + (options.check_extensions && gives_check);
+        s->ply++;
+        int score;
+        if (move_count == 1) {
+            score = -search_node(s, -beta, -alpha, new_depth);
+        } else {
+            int r = 0;
+            if (options.lmr && depth >= 3 && move_count > 3 && quiet && !checked && !gives_check) {
+                r = reductions[(depth < 64) ? depth: 63][(move_count < 64) ? move_count: 63] - pv_node;
+                r = (r < 0) ? 0: (r > new_depth - 1) ? new_depth - 1: r;
+            }
+            score = -search_node(s, -alpha - 1, -alpha, new_depth - r);
+            if (r && score > alpha) {
+                score = -search_node(s, -alpha - 1, -alpha, new_depth);
+            }
+            if (score > alpha && score < beta) {
+                score = -search_node(s, -beta, -alpha, new_depth);
+            }
+        }
+        s->ply--;
+        undo_move(b, m, &undo);
+        if (search_aborted(s)) return 0;
+
+        if (score > best) {
+            best = score;
+            best_move = m;
+            if (score > alpha) {
+                alpha = score;
+                s->pv[ply][0] = m;
+                memcpy(&s->pv[ply][1], s->pv[ply + 1], s->pv_length[ply + 1] * sizeof(move));
+                s->pv_length[ply] = s->pv_length[ply + 1] + 1;
+                if (score >= beta) {
+                    s->stage_cutoffs[picker.move_stage]++;
+                    if (!is_capture(m) && !is_promotion(m)) {
+                        update_quiet_stats(s, m, depth, quiets, quiet_count);
+                    }
+                    break;
+                }
+            }
+        }
+        if (quiet && quiet_count < 64) {
+            quiets[quiet_count++] = m;
+        }
+    }
+    if (!move_count) {
+        return (checked) ? -MATE_SCORE + ply: 0;
+    }
+
+    if (s->tt) {
+        int bound = (best >= beta) ? TT_LOWER: (best > original_alpha) ? TT_EXACT: TT_UPPER;
+        tt_store(s->tt, b->key, ply, (bound == TT_UPPER) ? 0: best_move, best, depth, bound);
+    }
+    return best;
+}
+
+/*
+ * Prints one line per completed iteration in UCI info format. The time 
+ * column is the time to reach depth.
+*/
+void search_report(search_info* s) {
+    int64_t elapsed = time_ms() - s->start;
+    uint64_t nodes = search_nodes(s);
+    printf("info depth %d score ", s->depth);
+    if (s->score > MATE_BOUND) {
+        printf("mate %d", (MATE_SCORE - s->score + 1) / 2);
+    } else if (s->score < -MATE_BOUND) {
+        printf("mate %d", -(MATE_SCORE + s->score) / 2);
+    } else {
+        printf("cp %d", s->score);
+    }
+    printf(" nodes %" PRIu64 " nps %" PRIu64 " time %" PRId64, \
+           nodes, (elapsed) ? nodes * 1000 / elapsed: nodes * 1000, elapsed);
+    if (s->tt) printf(" hashfull %d", tt_hashfull(s->tt));
+    printf(" pv");
+    for (int i = 0; i < s->pv_length[0]; i++) {
+        char move_str[6];
+        move_to_uci(s->pv[0][i], move_str);
+        printf(" %s", move_str);
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+/*
+ * Lazy SMP helpers skip some depths so threads spread over neighbouring 
+ * iterations instead of all searching the same one. Helper i skips depth d 
+ * when (d + phase) / size is odd, using entry (i - 1) % 20 of each table.
+*/
+int skip_size[20] = {1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4, 4};
+int skip_phase[20] = {0, 1, 0, 1, 2, 3, 0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 5, 6, 7};
+
+/*
+ * Iterative deepening loop run by every thread. Only the main thread 
+ * reports and, once it finishes its last iteration, stops the helpers. 
+ * An interrupted iteration is thrown away unless it is the first, in which 
+ * case the best move found so far is kept. With infinite limits the main 
+ * thread waits to be stopped before returning.
+*/
+void* search_iterate(void* arg) {
+    search_info* s = arg;
+    int max_depth = (s->limits.depth > 0 && s->limits.depth < MAX_PLY) ? s->limits.depth: MAX_PLY - 1;
+    for (int depth = 1; depth <= max_depth; depth++) {
+        if (s->thread_id) {
+            int i = (s->thread_id - 1) % 20;
+            if (((depth + skip_phase[i]) / skip_size[i]) % 2) continue;
+        }
+        int score = search_node(s, -INFINITE_SCORE, INFINITE_SCORE, depth);
+        if (search_aborted(s) && s->depth) break;
+        if (s->pv_length[0]) s->best_move = s->pv[0][0];
+        if (search_aborted(s)) break;
+
+        s->depth = depth;
+        s->score = score;
+        if (s == s->main) search_report(s);
+        // No need to look deeper once a forced mate is found or there are no moves.
+        if (!s->best_move || score > MATE_BOUND || score < -MATE_BOUND) break;
+    }
+    while (s == s->main && __atomic_load_n(&s->limits.infinite, __ATOMIC_RELAXED) && !search_aborted(s)) {
+        struct timespec pause = {0, 1000000};
+        nanosleep(&pause, NULL);
+    }
+    if (s == s->main) search_stop(s);
+    return NULL;
+}
+
+/*
+ * Searches b with iterative deepening on threads threads using table tt, 
+ * which may be NULL, until a limit is reached. s must hold an info per 
+ * thread. Helper threads search the same root on their own board copies 
+ * and only share results through tt, so threads beyond the first need a 
+ * table to be of use. Returns the best move of the thread which completed 
+ * the deepest iteration, preferring the main thread, or 0 if there are no 
+ * legal moves. The result is also left in the main thread's info. b is 
+ * not changed. history holds the game positions before b, NULL if none.
+*/
+move search(board* b, game_history* history, search_limits* limits, tt_table* tt, int threads, search_info* s) {
+    if (tt) tt_new_search(tt);
+    int64_t start = time_ms();
+    for (int i = 0; i < threads; i++) {
+        board_copy(&s[i].board, b);
+        s[i].b = &s[i].board;
+        s[i].tt = tt;
+        s[i].main = s;
+        s[i].thread_id = i;
+        s[i].thread_count = threads;
+        s[i].limits = *limits;
+        s[i].start = start;
+        s[i].nodes = 0;
+        s[i].stop = 0;
+        s[i].ply = 0;
+        s[i].history_count = (history) ? history->count: 0;
+        if (history) memcpy(s[i].keys, history->keys, history->count * sizeof(uint64_t));
+        s[i].depth = 0;
+        s[i].score = 0;
+        s[i].best_move = 0;
+        s[i].null_verifying = 0;
+        s[i].pawns.hits = 0;
+        s[i].pawns.misses = 0;
+        // Killers and countermoves belong to the last position, history is kept but aged.
+        memset(s[i].killers, 0, sizeof(s[i].killers));
+        memset(s[i].counter_moves, 0, sizeof(s[i].counter_moves));
+        memset(s[i].stage_moves, 0, sizeof(s[i].stage_moves));
+        memset(s[i].stage_cutoffs, 0, sizeof(s[i].stage_cutoffs));
+        for (int side = BLACK; side <= WHITE; side++) {
+            for (int from = 0; from < 64; from++) {
+                for (int to = 0; to < 64; to++) {
+                    s[i].history[side][from][to] /= 2;
+                }
+            }
+        }
+    }
+
+    pthread_t helpers[threads];
+    int started = 1;
+    for (; started < threads; started++) {
+        if (pthread_create(&helpers[started], NULL, search_iterate, &s[started])) {
+            printf("Search thread failed to start\n");
+            break;
+        }
+    }
+    search_iterate(s);
+    for (int i = 1; i < started; i++) {
+        pthread_join(helpers[i], NULL);
+    }
+
+    for (int i = 1; i < started; i++) {
+        if (s[i].best_move && s[i].depth > s->depth) {
+            s->depth = s[i].depth;
+            s->score = s[i].score;
+            s->best_move = s[i].best_move;
+        }
+    }
+    if (!s->best_move) {
+        move_list list;
+        if (generate_moves(b, &list)) s->best_move = list.moves[0];
+    }
+    // Before bestmove, so GUIs attribute the report to this search.
+    picker_report(s);
+    if (s->best_move) {
+        char move_str[6];
+        move_to_uci(s->best_move, move_str);
+        printf("bestmove %s\n", move_str);
+    } else {
+        printf("bestmove 0000\n");
+    }
+    fflush(stdout);
+    return s->best_move;
+}
+
+/*
+ * Returns legal move in b written as str in UCI notation, or 0 if there is none.
+*/
+move parse_move(board* b, char* str) {
+    move_list list;
+    generate_moves(b, &list);
+    for (int i = 0; i < list.count; i++) {
+        char move_str[6];
+        move_to_uci(list.moves[i], move_str);
+        if (!strcmp(move_str, str)) return list.moves[i];
+    }
+    return 0;
+}
+
+/* 
+ * Plays a game against the engine from the standard position. The user 
+ * enters moves in UCI notation, eg. e2e4, which are validated against the 
+ * legal moves, and the engine replies after searching for a second. 
+*/
+void play_game() {
+    board* b = board_alloc();
+    set_standard(b);
+    search_limits limits = {.movetime = 1000};
+    search_info* s = search_info_alloc(1);
+    tt_table* tt = tt_alloc(64);
+    if (!s || !tt) {
+        if (s) search_info_delete(s);
+        if (tt) tt_delete(tt);
+        board_delete(b);
+        return;
+    }
 
+    char line[64];
+    move_list list;
+    game_history history = {.count = 0};
+    while (generate_moves(b, &list)) {
+        char* b_str = board_string(b);
+        printf("%s\nYour move: ", b_str);
+        free(b_str);
+        if (!fgets(line, sizeof(line), stdin)) break;
+        line[strcspn(line, "\r\n")] = '\0';
+        move m = parse_move(b, line);
+        if (!m) {
+            printf("Illegal move %s\n", line);
+            continue;
+        }
+        move_undo undo;
+        history_push(&history, b);
+        do_move(b, m, &undo);
+        move reply = search(b, &history, &limits, tt, 1, s);
+        if (!reply) break;
+        history_push(&history, b);
+        do_move(b, reply, &undo);
+    }
+    printf("Game over\n");
+    tt_delete(tt);
+    search_info_delete(s);
+    board_delete(b);
 }
 
 /* 
  * Converts an input fen representation into internal bitboard representation. 
  * Used to parse various game boards for move evaluation. 
+ * Returns 1 on success. Returns 0 if the fen has fewer than six fields, an 
+ * unknown side to move or en passant square, anything but one king per side 
+ * or the side not to move in check, in which case b holds only the pieces 
+ * and must not be searched.
 */
-void parse_fen(board* b, char *fen) {
+int parse_fen(board* b, char *fen) {
     set_empty(b);
     char* fields[6]; 
     char* token = strtok(fen, " ");
+    if (token == NULL) return 0;
     fields[0] = token;
     for (int i = 1; i < 6; i++) {
         token = strtok(NULL, " ");
-        if (token == NULL) {
-            printf("fen must contain six fields separated by spaces");
-            return;
-        }
+        if (token == NULL) return 0;
         fields[i] = token;
     }
     
@@ -1454,62 +3462,132 @@ void parse_fen(board* b, char *fen) {
         if (c == '8') n = 8;
 
         if (!n) {
-            switch(c) {
-                case 'p':
-                    b->pawn_b |= loc_mask;
-                    break;
-                case 'q':
-                    b->queen_b |= loc_mask;
-                    break;
-                case 'k':
-                    b->king_b |= loc_mask;
-                    break;
-                case 'r':
-                    b->rook_b |= loc_mask;
-                    break;
-                case 'n':
-                    b->knight_b |= loc_mask;
-                    break;
-                case 'b':
-                    b->bishop_b |= loc_mask;
-                    break;
-                case 'P':
-                    b->pawn_w |= loc_mask;
-                    break;
-                case 'Q':
-                    b->queen_w |= loc_mask;
-                    break;
-                case 'K':
-                    b->king_w |= loc_mask;
-                    break;
-                case 'R':
-                    b->rook_w |= loc_mask;
-                    break;
-                case 'N':
-                    b->knight_w |= loc_mask;
-                    break;
-                case 'B':
-                    b->bishop_w |= loc_mask;
-                    break;
-                case '/':
-                    if (!loc_mask) {
-                        loc_mask = 0x0001000000000000;
-                    } else {
-                        loc_mask = loc_mask >> 16;
+            if (c == '/') {
+                if (!loc_mask) {
+                    loc_mask = 0x0001000000000000;
+                } else {
+                    loc_mask = loc_mask >> 16;
+                }
+                continue;
+            }
+            int placed = 0;
+            for (int side = BLACK; side <= WHITE; side++) {
+                for (int piece = PAWN; piece <= KING; piece++) {
+                    if (piece_names[side][piece] == c) {
+                        b->pieces[piece] |= loc_mask;
+                        b->colors[side] |= loc_mask;
+                        placed = 1;
                     }
-                default:
-                    continue;
+                }
             }
+            if (!placed) continue;
             loc_mask = loc_mask << 1;
         } else {
             loc_mask = loc_mask << n;
         }
     }
-    if (fields[1][0] == 'w') {
-        b->turn = 1;
-    } else {
-       b->turn = 0; 
+    uint64_t w_king = piece_board(b, WHITE, KING);
+    uint64_t b_king = piece_board(b, BLACK, KING);
+    if (!w_king || (w_king & (w_king - 1)) || !b_king || (b_king & (b_king - 1))) return 0;
+    if (strcmp(fields[1], "w") && strcmp(fields[1], "b")) return 0;
+    set_side_to_move(b, fields[1][0] == 'w');
+    if (in_check(b, !side_to_move(b))) return 0;
+
+    int rights = 0;
+    for (int i = 0; i < strlen(fields[2]); i++) {
+        switch (fields[2][i]) {
+            case 'K':
+                rights |= CASTLE_W_R;
+                break;
+            case 'Q':
+                rights |= CASTLE_W_L;
+                break;
+            case 'k':
+                rights |= CASTLE_B_R;
+                break;
+            case 'q':
+                rights |= CASTLE_B_L;
+                break;
+        }
+    }
+    set_castle_rights(b, rights);
+
+    if (fields[3][0] != '-') {
+        char ep_rank = (side_to_move(b)) ? '6': '3';
+        if (fields[3][0] < 'a' || fields[3][0] > 'h' || fields[3][1] != ep_rank) return 0;
+        int target = (fields[3][1] - '1') * 8 + fields[3][0] - 'a';
+        // The pawn that just pushed two squares must stand in front of the 
+        // target, with the target and the square it left empty.
+        int pushed = (side_to_move(b)) ? target - 8: target + 8;
+        int start = (side_to_move(b)) ? target + 8: target - 8;
+        uint64_t occupied = b->colors[BLACK] | b->colors[WHITE];
+        if (!(b->pieces[PAWN] & b->colors[!side_to_move(b)] & ((uint64_t) 1 << pushed)) \
+                || (occupied & (((uint64_t) 1 << target) | ((uint64_t) 1 << start)))) {
+            return 0;
+        }
+        set_en_passant(b, target);
+    }
+
+    int halfmove = atoi(fields[4]);
+    b->halfmove = (halfmove < 0) ? 0: (halfmove > UINT8_MAX) ? UINT8_MAX: halfmove;
+
+    set_mailbox(b);
+    b->key = compute_key(b);
+    b->pawn_key = compute_pawn_key(b);
+    compute_eval(b);
+    return 1;
+}
+
+/*
+ * Fixed positions for search_bench: the perft positions and some middlegames.
+*/
+char* bench_fens[] = {
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+    "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+    "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+    "r3k2r/2pb1ppp/2pp1q2/p7/1nP1B3/1P2P3/P2N1PPP/R2QK2R w KQkq a6 0 14",
+    "4rrk1/2p1b1p1/p1p3q1/4p3/2P2n1p/1P1NR2P/PB3PP1/3R1QK1 b - - 2 24",
+    "r3qbrk/6p1/2b2pPp/p3pP1Q/PpPpP2P/3P1B2/2PB3K/R5R1 w - - 16 42"
+};
+
+/*
+ * Searches every bench position to depth from a cleared table on threads 
+ * threads and prints total nodes, time and nodes per second, so runs with 
+ * different search options can be compared.
+*/
+void search_bench(int depth, int threads) {
+    board* b = board_alloc();
+    search_info* s = search_info_alloc(threads);
+    tt_table* tt = tt_alloc(16);
+    if (!b || !s || !tt) {
+        printf("Bench failed to allocate\n");
+        if (b) board_delete(b);
+        if (s) search_info_delete(s);
+        if (tt) tt_delete(tt);
+        return;
     }
-    set_sides(b);
+
+    search_limits limits = {.depth = depth};
+    uint64_t nodes = 0;
+    int64_t start = time_ms();
+    for (int i = 0; i < (int) (sizeof(bench_fens) / sizeof(bench_fens[0])); i++) {
+        // parse_fen tokenises its argument in place.
+        char fen[128];
+        strncpy(fen, bench_fens[i], sizeof(fen) - 1);
+        fen[sizeof(fen) - 1] = '\0';
+        parse_fen(b, fen);
+        tt_clear(tt);
+        search(b, NULL, &limits, tt, threads, s);
+        nodes += search_nodes(s);
+    }
+    int64_t elapsed = time_ms() - start;
+    printf("Bench: %" PRIu64 " nodes %" PRId64 " ms %" PRIu64 " nps\n", \
+           nodes, elapsed, (elapsed) ? nodes * 1000 / elapsed: nodes * 1000);
+
+    tt_delete(tt);
+    search_info_delete(s);
+    board_delete(b);
 }
 
@@ -0,0 +1,124 @@
+#include "../chess.c"
+
+/*
+ * Perft regression suite. Reads an EPD file where each line is a fen
+ * followed by expected node counts, eg. "<fen> ;D1 20 ;D2 400", and checks
+ * every depth up to the depth limit. Prints nodes per second for each
+ * position and in total, and exits non-zero on any wrong count or when the
+ * total speed is below the optional minimum.
+ *
+ * Usage: perft_suite [epd file] [max depth] [min nps]
+*/
+
+#define SUITE_MAX_DEPTH 16
+
+typedef struct epd_entry {
+    char fen[128];
+    uint64_t expected[SUITE_MAX_DEPTH + 1];
+    int max_depth;
+} epd_entry;
+
+/*
+ * Splits one EPD line into its fen and expected counts. Returns 0 for blank
+ * lines, comments and lines without any counts.
+*/
+int parse_epd_entry(char* line, epd_entry* e) {
+    line[strcspn(line, "\r\n")] = '\0';
+    if (!line[0] || line[0] == '#') return 0;
+    char* counts = strchr(line, ';');
+    if (!counts) return 0;
+
+    int fen_length = counts - line;
+    while (fen_length && line[fen_length - 1] == ' ') fen_length--;
+    if (fen_length >= (int) sizeof(e->fen) - 5) return 0;
+    memcpy(e->fen, line, fen_length);
+    e->fen[fen_length] = '\0';
+    // EPD positions may leave out the move counters parse_fen expects.
+    int spaces = 0;
+    for (int i = 0; i < fen_length; i++) {
+        if (e->fen[i] == ' ') spaces++;
+    }
+    if (spaces == 3) strcat(e->fen, " 0 1");
+
+    memset(e->expected, 0, sizeof(e->expected));
+    e->max_depth = 0;
+    for (; counts; counts = strchr(counts + 1, ';')) {
+        int depth;
+        uint64_t nodes;
+        if (sscanf(counts, "; D%d %" SCNu64, &depth, &nodes) != 2) continue;
+        if (depth < 1 || depth > SUITE_MAX_DEPTH) continue;
+        e->expected[depth] = nodes;
+        if (depth > e->max_depth) e->max_depth = depth;
+    }
+    return e->max_depth > 0;
+}
+
+int main(int argc, char** argv) {
+    char* path = (argc > 1) ? argv[1]: "perft.epd";
+    int depth_limit = (argc > 2) ? atoi(argv[2]): 6;
+    uint64_t min_nps = (argc > 3) ? strtoull(argv[3], NULL, 10): 0;
+
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        printf("Error could not open %s\n", path);
+        return 1;
+    }
+    init_tables();
+    board b;
+
+    char line[512];
+    int positions = 0;
+    int failures = 0;
+    uint64_t total_nodes = 0;
+    int64_t total_time = 0;
+    while (fgets(line, sizeof(line), f)) {
+        epd_entry e;
+        if (!parse_epd_entry(line, &e)) continue;
+
+        uint64_t nodes = 0;
+        int64_t elapsed = 0;
+        int deepest = 0;
+        for (int depth = 1; depth <= e.max_depth && depth <= depth_limit; depth++) {
+            if (!e.expected[depth]) continue;
+            // parse_fen tokenises its argument in place.
+            char fen[128];
+            strcpy(fen, e.fen);
+            if (!parse_fen(&b, fen)) {
+                printf("Error invalid fen %s\n", e.fen);
+                failures++;
+                break;
+            }
+            int64_t start = time_ms();
+            uint64_t count = perft(&b, depth);
+            elapsed += time_ms() - start;
+            nodes += count;
+            deepest = depth;
+            if (count != e.expected[depth]) {
+                printf("Error %s depth %d expected %" PRIu64 " got %" PRIu64 "\n", \
+                       e.fen, depth, e.expected[depth], count);
+                failures++;
+            }
+        }
+        if (!deepest) continue;
+        positions++;
+        printf("D%d %12" PRIu64 " nodes %7" PRId64 " ms %12" PRIu64 " nps  %s\n", deepest, nodes, \
+               elapsed, (elapsed) ? nodes * 1000 / elapsed: nodes * 1000, e.fen);
+        total_nodes += nodes;
+        total_time += elapsed;
+    }
+    fclose(f);
+
+    uint64_t total_nps = (total_time) ? total_nodes * 1000 / total_time: total_nodes * 1000;
+    printf("Total %d positions %" PRIu64 " nodes %" PRId64 " ms %" PRIu64 " nps\n", \
+           positions, total_nodes, total_time, total_nps);
+    if (min_nps && total_nps < min_nps) {
+        printf("Error %" PRIu64 " nps is below the minimum %" PRIu64 "\n", total_nps, min_nps);
+        failures++;
+    }
+    if (failures) {
+        printf("Error %d failures\n", failures);
+        return 1;
+    }
+    printf("Success. All perft counts match.\n");
+    return 0;
+}
@@ -1,6 +1,24 @@
+#include <stdlib.h>
+
+// Counts heap allocations made by the engine so hot paths can be checked for malloc traffic.
+int malloc_calls = 0;
+
+void* counting_malloc(size_t size) {
+    malloc_calls++;
+    return malloc(size);
+}
+
+void* counting_calloc(size_t count, size_t size) {
+    malloc_calls++;
+    return calloc(count, size);
+}
+
+#define malloc counting_malloc
+#define calloc counting_calloc
 #include "../chess.c"
 
 int main(void) {
+    init_tables();
     board* perft_board = board_alloc();
     set_standard(perft_board); 
     uint64_t perft_test_1 = perft_divide(perft_board, 3); 
@@ -11,12 +29,9 @@ int main(void) {
     }
     char fen_1[73] = "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1";
     parse_fen(perft_board, fen_1);
-        perft_board->castle_w_l = 0;
-    perft_board->castle_w_r = 0;
-    perft_board->castle_b_l = 0;
-    perft_board->castle_b_r = 0;
+    set_castle_rights(perft_board, 0);
     printf("\n\n\nSecond test\n\n");
-    uint64_t perft_test_2 = perft_divide(perft_board, 3); 
+    uint64_t perft_test_2 = perft_divide(perft_board, 2); 
     if (perft_test_2 != 191) {
         printf("Error invalid perft test postion 3 depth 2, %" PRIu64 "\n", perft_test_2);
     } else {
@@ -26,13 +41,10 @@ int main(void) {
     char fen_10[73] = "n1n5/PPPk4/8/8/8/8/4Kppp/5N1N b - - 0 1";
     parse_fen(perft_board, fen_10);
     printf("\nboard is %s\n", board_string(perft_board));
-    perft_board->castle_w_l = 0;
-    perft_board->castle_w_r = 0;
-    perft_board->castle_b_l = 0;
-    perft_board->castle_b_r = 0;
+    set_castle_rights(perft_board, 0);
     printf("\n\n\nDivide test\n\n");
-    uint64_t perft_test_10 = perft_divide(perft_board, 1); 
-    if (perft_test_10 != 360503) {
+    uint64_t perft_test_10 = perft_divide(perft_board, 3); 
+    if (perft_test_10 != 9483) {
         printf("Error invalid perft test divide test pos, %" PRIu64 "\n", perft_test_10);
     } else {
         printf("Success. Second perft test success. Divide\n");
@@ -40,21 +52,36 @@ int main(void) {
 
     // Pawn corner attack test 
     char fen_corner[73] = "8/8/8/8/8/8/6p1/7N b - - 0 1";
-    parse_fen(perft_board, fen_corner);
+    if (parse_fen(perft_board, fen_corner)) {
+        printf("Error fen without kings accepted\n");
+    } else {
+        printf("Success. Fen without kings rejected.\n");
+    }
+
+    // En passant square needs the pushed pawn in front of it and both squares it crossed empty.
+    char fen_ep_no_pawn[] = "4k3/8/8/8/8/8/8/4K3 w - e6 0 1";
+    char fen_ep_blocked[] = "4k3/4p3/8/4p3/8/8/8/4K3 w - e6 0 1";
+    char fen_ep_ok[] = "4k3/8/8/3Pp3/8/8/8/4K3 w - e6 0 1";
+    board ep_board;
+    int ep_no_pawn = parse_fen(&ep_board, fen_ep_no_pawn);
+    int ep_blocked = parse_fen(&ep_board, fen_ep_blocked);
+    int ep_ok = parse_fen(&ep_board, fen_ep_ok);
+    if (ep_no_pawn || ep_blocked || !ep_ok || perft(&ep_board, 1) != 7) {
+        printf("Error en passant fen checks %d %d %d\n", ep_no_pawn, ep_blocked, ep_ok);
+    } else {
+        printf("Success. Fen with impossible en passant square rejected.\n");
+    }
     printf("\nboard is %s\n", board_string(perft_board));
     printf("\n\n\nCorner test\n\n");
-    uint64_t corner_pawn_moves = pawn_b_move_board(perft_board->pawn_b, perft_board->white, perft_board->black);
+    uint64_t corner_pawn_moves = pawn_move_board(piece_board(perft_board, BLACK, PAWN), perft_board->colors[BLACK], perft_board->colors[WHITE], BLACK);
     printf("Corner test result, %" PRIu64 "\n", corner_pawn_moves);
 
     char fen_3[73] = "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1";
     parse_fen(perft_board, fen_3);
-    perft_board->castle_w_l = 0;
-    perft_board->castle_w_r = 0;
-    perft_board->castle_b_l = 1;
-    perft_board->castle_b_r = 1;
+    set_castle_rights(perft_board, CASTLE_B_L | CASTLE_B_R);
     printf("\n\n\nThird test\n\n");
     uint64_t perft_test_3 = perft_divide(perft_board, 3); 
-    if (perft_test_3 != 264) {
+    if (perft_test_3 != 9467) {
         printf("Error invalid perft test position 4 depth 3, %" PRIu64 "\n", perft_test_3);
     } else {
         printf("Success. Second perft test success. Pos 4 depth 3\n");
@@ -62,10 +89,7 @@ int main(void) {
 
     char fen_4[73] = "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8 ";
     parse_fen(perft_board, fen_4);
-    perft_board->castle_w_l = 1;
-    perft_board->castle_w_r = 1;
-    perft_board->castle_b_l = 0;
-    perft_board->castle_b_r = 0;
+    set_castle_rights(perft_board, CASTLE_W_L | CASTLE_W_R);
     printf("\n\n\nFourth test\n\n");
     uint64_t perft_test_4 = perft_divide(perft_board, 1); 
     if (perft_test_4 != 44) {
@@ -76,75 +100,85 @@ int main(void) {
 
     char fen_5[73] = "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10";
     parse_fen(perft_board, fen_5);
-    perft_board->castle_w_l = 0;
-    perft_board->castle_w_r = 0;
-    perft_board->castle_b_l = 0;
-    perft_board->castle_b_r = 0;
+    set_castle_rights(perft_board, 0);
     printf("\n\n\nFifth test\n\n");
     uint64_t perft_test_5 = perft_divide(perft_board, 2); 
     if (perft_test_5 != 2079) {
-        printf("Error invalid perft test position 6 depth 1 %" PRIu64 "\n", perft_test_5);
+        printf("Error invalid perft test position 6 depth 2 %" PRIu64 "\n", perft_test_5);
     } else {
-        printf("Success. Fifth perft test success. pos 6 depth 1\n");
+        printf("Success. Fifth perft test success. pos 6 depth 2\n");
     }
 
     char fen_6[73] = "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 10";
     parse_fen(perft_board, fen_6);
-    perft_board->castle_w_l = 1;
-    perft_board->castle_w_r = 1;
-    perft_board->castle_b_l = 1;
-    perft_board->castle_b_r = 1;
+    set_castle_rights(perft_board, CASTLE_W_L | CASTLE_W_R | CASTLE_B_L | CASTLE_B_R);
     printf("\n\n\nFifth test\n\n");
     uint64_t perft_test_6 = perft_divide(perft_board, 2); 
     if (perft_test_6 != 2039) {
         printf("Error invalid perft test position 2 depth 2 %" PRIu64 "\n", perft_test_6);
     } else {
-        printf("Success. Fifth perft test success. pos 2 depth 1\n");
+        printf("Success. Fifth perft test success. pos 2 depth 2\n");
     }
     // Basic test for white legal move generation. 
     board* b = board_alloc();
     set_standard(b);
-    uint64_t white_legal_moves = w_legal_moves(b);
+    uint64_t white_legal_moves = legal_move_targets(b, WHITE);
     if (white_legal_moves != 0x00000000FFFF0000) {
         printf("Error invalid legal white move gen %" PRIu64 "\n", white_legal_moves);
     } else {
         printf("Success. White legal moves correct.\n");
     }
     
-    if (b->king_w != 0x0000000000000010) {
-        printf("Error king position %" PRIu64 "\n", b->king_w);
+    if (piece_board(b, WHITE, KING) != 0x0000000000000010) {
+        printf("Error king position %" PRIu64 "\n", piece_board(b, WHITE, KING));
     }
-    if (b->white != 0x000000000000FFFF) {
-        printf("Error bad white side %" PRIu64 "\n", b->white);
+    if (b->colors[WHITE] != 0x000000000000FFFF) {
+        printf("Error bad white side %" PRIu64 "\n", b->colors[WHITE]);
     }
-    uint64_t king_w_moves = king_move_board(b->king_w, b->white, b->black); 
+    uint64_t king_w_moves = king_move_board(piece_board(b, WHITE, KING), b->colors[WHITE], b->colors[BLACK]); 
     if (king_w_moves != 0) {
         printf("Error invalid move board %" PRIu64 "\n", king_w_moves);
     } else {
         printf("Success.\n");
     }
 
-    uint64_t knight_b_moves = knight_move_board(b->knight_w, b->white);
+    uint64_t knight_b_moves = knight_move_board(piece_board(b, WHITE, KNIGHT), b->colors[WHITE]);
     if (knight_b_moves != 0x0000000000A50000) {
         printf("Error knight board %" PRIu64 "\n", knight_b_moves);
     } else {
         printf("knight success \n");
     }
 
-    uint64_t white_pawn_moves = pawn_w_move_board(b->pawn_w, b->white, b->black);
+    // Per square lookups must match the set-wise shifts. A board full of enemy 
+    // pieces blocks pawn pushes so only captures are left.
+    int step_errors = 0;
+    for (int sq = 0; sq < 64; sq++) {
+        uint64_t pos = (uint64_t) 1 << sq;
+        step_errors += knight_attacks(sq) != knight_move_board(pos, 0);
+        step_errors += king_attacks(sq) != king_move_board(pos, 0, 0);
+        step_errors += pawn_attacks(WHITE, sq) != pawn_move_board(pos, 0, ~pos, WHITE);
+        step_errors += pawn_attacks(BLACK, sq) != pawn_move_board(pos, 0, ~pos, BLACK);
+    }
+    if (step_errors) {
+        printf("Error %d attack table entries differ\n", step_errors);
+    } else {
+        printf("Success. Attack tables match shifts.\n");
+    }
+
+    uint64_t white_pawn_moves = pawn_move_board(piece_board(b, WHITE, PAWN), b->colors[WHITE], b->colors[BLACK], WHITE);
     if (white_pawn_moves != 0x00000000FFFF0000) {
         printf("Pawn error %" PRIu64 "\n", white_pawn_moves);
     } else {
         printf("Pawn success \n");
     }
 
-    uint64_t black_pawn_moves = pawn_b_move_board(b->pawn_b, b->white, b->black);
+    uint64_t black_pawn_moves = pawn_move_board(piece_board(b, BLACK, PAWN), b->colors[BLACK], b->colors[WHITE], BLACK);
     if (black_pawn_moves != 0x0000FFFF00000000) {
         printf("Pawn error %" PRIu64 "\n", black_pawn_moves);
     } else {
         printf("Pawn success \n");
     }
-    uint64_t white_rook_moves = rook_move_board(b->rook_w, b->white, b->black);
+    uint64_t white_rook_moves = rook_move_board(piece_board(b, WHITE, ROOK), b->colors[WHITE], b->colors[BLACK]);
     if (white_rook_moves != 0) {
         printf("Rook error %" PRIu64 "\n", white_pawn_moves);
     } else {
@@ -167,7 +201,7 @@ int main(void) {
         printf("Valid rook board. \n");
     }
  
-    uint64_t white_bishop_moves = bishop_move_board(b->bishop_w, b->white, b->black);
+    uint64_t white_bishop_moves = bishop_move_board(piece_board(b, WHITE, BISHOP), b->colors[WHITE], b->colors[BLACK]);
     if (white_bishop_moves != 0) {
        printf("Test bishop error %" PRIu64 "\n", white_bishop_moves);
     } else {
@@ -194,7 +228,7 @@ int main(void) {
         printf("Success on bishop\n");
     }
 
-    uint64_t queen_moves = queen_move_board(b->queen_b, b->black, b->white); 
+    uint64_t queen_moves = queen_move_board(piece_board(b, BLACK, QUEEN), b->colors[BLACK], b->colors[WHITE]); 
 
     if (queen_moves != 0) {
        printf("Queen 1 error %" PRIu64 "\n", queen_moves);
@@ -216,21 +250,18 @@ int main(void) {
     free(b);
     b = board_alloc();
     set_standard(b);
-    if ((b->white | b-> black) != 0xFFFF00000000FFFF) {
-        printf("Board initialization error %" PRIu64 "\n", b->white | b->black);
+    if ((b->colors[WHITE] | b->colors[BLACK]) != 0xFFFF00000000FFFF) {
+        printf("Board initialization error %" PRIu64 "\n", b->colors[WHITE] | b->colors[BLACK]);
     } else {
         printf("Correct board initilization\n");
     }
 
-    b_2->turn = b->turn;
-    b_2->castle_w_l = b->castle_w_l;                               
-    b_2->castle_w_r = b->castle_w_r;                               
-    b_2->castle_b_l = b->castle_b_l;                               
-    b_2->castle_b_r = b->castle_b_r;                               
+    set_side_to_move(b_2, side_to_move(b));
+    set_castle_rights(b_2, get_castle_rights(b));
     if (!board_equals(b, b_2)) {
-       printf("Incorrect fen position parsing new board %" PRIu64 " correct board %" PRIu64 "\n", b_2->white | b_2->black, b->white | b->black);
-       printf("Piece check %d\n", (b->queen_w == b_2->queen_w));
-       printf("The black king is %" PRIu64 "\n", b_2->king_w);
+       printf("Incorrect fen position parsing new board %" PRIu64 " correct board %" PRIu64 "\n", b_2->colors[WHITE] | b_2->colors[BLACK], b->colors[WHITE] | b->colors[BLACK]);
+       printf("Piece check %d\n", (piece_board(b, WHITE, QUEEN) == piece_board(b_2, WHITE, QUEEN)));
+       printf("The black king is %" PRIu64 "\n", piece_board(b_2, WHITE, KING));
     } else {
         printf("Success on fen parsing\n");
     }
@@ -239,6 +270,342 @@ int main(void) {
     char fen_2[] = "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8";
     parse_fen(b, fen_2);
     printf("The board is %s\n", board_string(b));
+
+    // Legal move generation and perft must not touch the heap.
+    char fen_alloc[] = "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 10";
+    parse_fen(b, fen_alloc);
+    set_castle_rights(b, CASTLE_W_L | CASTLE_W_R | CASTLE_B_L | CASTLE_B_R);
+    set_en_passant(b, 0);
+    malloc_calls = 0;
+    legal_move_targets(b, WHITE);
+    legal_move_targets(b, BLACK);
+    if (malloc_calls) {
+        printf("Error legal move generation made %d allocations\n", malloc_calls);
+    } else {
+        printf("Success. Legal move generation is allocation free.\n");
+    }
+    board before_perft;
+    board_copy(&before_perft, b);
+    malloc_calls = 0;
+    perft(b, 3);
+    if (malloc_calls) {
+        printf("Error perft made %d allocations\n", malloc_calls);
+    } else {
+        printf("Success. Perft is allocation free.\n");
+    }
+
+    // Applying and printing legacy moves and writing SAN must not allocate.
+    malloc_calls = 0;
+    board legacy;
+    board_copy(&legacy, b);
+    make_move((uint64_t) 1 << 36, (uint64_t) 1 << 53, &legacy, 1);
+    printf("\n");
+    char san_capture[8], san_castle[8];
+    move_to_san(b, encode_move(36, 53, CAPTURE), san_capture);
+    move_to_san(b, encode_move(4, 2, CASTLE_LEFT), san_castle);
+    if (malloc_calls || strcmp(san_capture, "Nxf7") || strcmp(san_castle, "O-O-O") \
+            || !(piece_board(&legacy, WHITE, KNIGHT) & (uint64_t) 1 << 53) || (piece_board(&legacy, BLACK, PAWN) & (uint64_t) 1 << 53)) {
+        printf("Error move notation %s %s made %d allocations\n", san_capture, san_castle, malloc_calls);
+    } else {
+        printf("Success. Move notation is allocation free.\n");
+    }
+
+    // The mailbox follows legacy moves, captures included, and board_string reads it.
+    board mailbox;
+    set_standard(&mailbox);
+    make_move((uint64_t) 1 << 12, (uint64_t) 1 << 28, &mailbox, 0);
+    make_move((uint64_t) 1 << 51, (uint64_t) 1 << 35, &mailbox, 0);
+    make_move((uint64_t) 1 << 28, (uint64_t) 1 << 35, &mailbox, 0);
+    char* mailbox_str = board_string(&mailbox);
+    if (!mailbox_consistent(&mailbox) || square_code(&mailbox, 35) != mailbox_code(WHITE, PAWN) \
+            || strcmp(mailbox_str, "\nrnbqkbnr\nppp-pppp\n--------\n---P----\n--------\n--------\nPPPP-PPP\nRNBQKBNR\n\n")) {
+        printf("Error mailbox out of sync %s\n", mailbox_str);
+    } else {
+        printf("Success. Mailbox matches bitboards.\n");
+    }
+    free(mailbox_str);
+
+    // Making and unmaking every move must restore the starting position.
+    if (!board_equals(b, &before_perft) || b->state != before_perft.state) {
+        printf("Error board changed after perft\n");
+    } else {
+        printf("Success. Unmake restores board.\n");
+    }
+
+    // Hashed perft must match the known counts, deep enough for key collisions to show.
+    perft_table* perft_cache = perft_table_alloc(16);
+    set_standard(b);
+    uint64_t hashed_start = perft_hashed(b, 6, perft_cache);
+    char fen_hashed[] = "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 10";
+    parse_fen(b, fen_hashed);
+    uint64_t hashed_kiwipete = perft_hashed(b, 5, perft_cache);
+    if (hashed_start != 119060324 || hashed_kiwipete != 193690690) {
+        printf("Error hashed perft start %" PRIu64 " kiwipete %" PRIu64 "\n", hashed_start, hashed_kiwipete);
+    } else {
+        printf("Success. Hashed perft counts.\n");
+    }
+    perft_table_report(perft_cache);
+    perft_table_delete(perft_cache);
+
+    // Parallel perft must match, with tasks split below the root and a shared table.
+    perft_cache = perft_table_alloc(16);
+    char fen_parallel[] = "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 10";
+    parse_fen(b, fen_parallel);
+    perft_split_depth = 2;
+    uint64_t parallel_kiwipete = perft_parallel(b, 4, 3, perft_cache);
+    perft_split_depth = 5;
+    if (parallel_kiwipete != 4085603) {
+        printf("Error parallel perft kiwipete %" PRIu64 "\n", parallel_kiwipete);
+    } else {
+        printf("Success. Parallel perft counts.\n");
+    }
+    perft_table_delete(perft_cache);
+
+    // Knights out and back again must transpose to the starting key.
+    set_standard(b);
+    uint64_t start_key = b->key;
+    move_undo key_undo[4];
+    do_move(b, encode_move(6, 21, QUIET), &key_undo[0]);
+    do_move(b, encode_move(62, 45, QUIET), &key_undo[1]);
+    do_move(b, encode_move(21, 6, QUIET), &key_undo[2]);
+    do_move(b, encode_move(45, 62, QUIET), &key_undo[3]);
+    if (b->key != start_key) {
+        printf("Error zobrist key differs after transposition %" PRIu64 "\n", b->key);
+    } else {
+        printf("Success. Zobrist transposition key.\n");
+    }
+
+    // Magic and PEXT slider backends must produce identical node counts.
+    if (cpu_has_bmi2()) {
+        char fen_backend[] = "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 10";
+        parse_fen(b, fen_backend);
+        set_slider_backend(SLIDER_MAGIC);
+        uint64_t magic_nodes = perft(b, 3);
+        set_slider_backend(SLIDER_PEXT);
+        uint64_t pext_nodes = perft(b, 3);
+        if (magic_nodes != pext_nodes) {
+            printf("Error slider backends differ magic %" PRIu64 " pext %" PRIu64 "\n", magic_nodes, pext_nodes);
+        } else {
+            printf("Success. Slider backends agree.\n");
+        }
+    }
+
+    // Symmetric start scores zero and incremental totals survive a make and unmake.
+    set_standard(b);
+    move_undo eval_undo;
+    int start_eval = evaluate(b, NULL);
+    do_move(b, encode_move(12, 28, DOUBLE_PUSH), &eval_undo);
+    int moved_consistent = eval_consistent(b);
+    undo_move(b, encode_move(12, 28, DOUBLE_PUSH), &eval_undo);
+    if (start_eval || !moved_consistent || !eval_consistent(b) || evaluate(b, NULL)) {
+        printf("Error incremental evaluation %d\n", start_eval);
+    } else {
+        printf("Success. Incremental evaluation.\n");
+    }
+
+    // Lone passed and isolated d5 pawn, scored once then served from the pawn table.
+    char fen_pawn[] = "4k3/8/8/3P4/8/8/8/4K3 w - - 0 1";
+    parse_fen(b, fen_pawn);
+    pawn_table* pawns = malloc(sizeof(pawn_table));
+    pawn_table_clear(pawns);
+    int pawn_mg, pawn_eg;
+    pawn_eval(b, pawns, &pawn_mg, &pawn_eg);
+    pawn_eval(b, pawns, &pawn_mg, &pawn_eg);
+    if (pawn_mg != 15 || pawn_eg != 30 || pawns->hits != 1 || pawns->misses != 1) {
+        printf("Error pawn structure %d %d\n", pawn_mg, pawn_eg);
+    } else {
+        printf("Success. Pawn structure cache.\n");
+    }
+    free(pawns);
+
+    // Staged picker must return every legal move exactly once whatever the tables hold.
+    char fen_picker[] = "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 10";
+    parse_fen(b, fen_picker);
+    search_info* picker_search = search_info_alloc(1);
+    picker_search->b = b;
+    picker_search->ply = 1;
+    picker_search->path[0] = encode_move(50, 34, DOUBLE_PUSH);
+    picker_search->killers[1][0] = encode_move(8, 16, QUIET);
+    picker_search->killers[1][1] = encode_move(21, 37, QUIET);
+    picker_search->counter_moves[50][34] = encode_move(36, 19, QUIET);
+    move_picker picker;
+    picker_init(&picker, picker_search, encode_move(21, 37, QUIET), 0);
+    move_list picker_all;
+    generate_moves(b, &picker_all);
+    int picked = 0, picker_ok = 1;
+    static char picked_moves[1 << 16];
+    move picker_move;
+    while ((picker_move = next_move(&picker, picker_search))) {
+        // Hash move first, then the one valid killer and the countermove straight after the captures.
+        if (!picked) picker_ok &= picker_move == encode_move(21, 37, QUIET);
+        if (picker.move_stage == STAGE_KILLER_1) picker_ok &= picker_move == encode_move(8, 16, QUIET);
+        if (picker.move_stage == STAGE_KILLER_2) picker_ok = 0;
+        if (picker.move_stage == STAGE_COUNTER) picker_ok &= picker_move == encode_move(36, 19, QUIET);
+        picker_ok &= !picked_moves[picker_move];
+        picked_moves[picker_move] = 1;
+        picked++;
+    }
+    for (int i = 0; i < picker_all.count; i++) {
+        picker_ok &= picked_moves[picker_all.moves[i]] == 1;
+    }
+    if (!picker_ok || picked != picker_all.count) {
+        printf("Error move picker returned %d of %d moves\n", picked, picker_all.count);
+    } else {
+        printf("Success. Move picker returns each move once.\n");
+    }
+
+    // Capture and promotion hash moves must pass move_valid and come first, once.
+    char* hash_fens[] = {"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 10", \
+        "4k3/P7/8/8/8/8/8/4K3 w - - 0 1", "1r2k3/P7/8/8/8/8/8/4K3 w - - 0 1"};
+    move hash_moves[] = {encode_move(36, 53, CAPTURE), encode_move(48, 56, PROMOTION | (QUEEN - KNIGHT)), \
+        encode_move(48, 57, PROMOTION_CAPTURE | (KNIGHT - KNIGHT))};
+    for (int i = 0; i < 3; i++) {
+        char hash_fen[100];
+        strcpy(hash_fen, hash_fens[i]);
+        parse_fen(b, hash_fen);
+        memset(picker_search->killers, 0, sizeof(picker_search->killers));
+        memset(picker_search->counter_moves, 0, sizeof(picker_search->counter_moves));
+        picker_init(&picker, picker_search, hash_moves[i], 0);
+        int hash_picked = 0, hash_first = 0;
+        picked = 0;
+        while ((picker_move = next_move(&picker, picker_search))) {
+            if (!picked) hash_first = picker_move == hash_moves[i];
+            hash_picked += picker_move == hash_moves[i];
+            picked++;
+        }
+        generate_moves(b, &picker_all);
+        if (!move_valid(b, hash_moves[i]) || !hash_first || hash_picked != 1 || picked != picker_all.count) {
+            printf("Error hash move %s not picked first\n", hash_fens[i]);
+        } else {
+            printf("Success. Hash move picked first in %s\n", hash_fens[i]);
+        }
+    }
+    search_info_delete(picker_search);
+
+    // Static exchange: free pawn, pawn defended against a rook, and a rook x-ray behind the first.
+    char fen_see_free[] = "1k1r4/1pp4p/p7/4p3/8/P5P1/1PP4P/2K1R3 w - - 0 1";
+    char fen_see_defended[] = "4k3/3p4/4p3/8/8/8/8/4RK2 w - - 0 1";
+    char fen_see_xray[] = "4k3/3p4/4p3/8/8/8/4R3/4RK2 w - - 0 1";
+    parse_fen(b, fen_see_free);
+    int see_free = see(b, encode_move(4, 36, CAPTURE));
+    parse_fen(b, fen_see_defended);
+    int see_defended = see(b, encode_move(4, 44, CAPTURE));
+    parse_fen(b, fen_see_xray);
+    int see_xray = see(b, encode_move(12, 44, CAPTURE));
+    if (see_free != 100 || see_defended != -400 || see_xray != -300) {
+        printf("Error static exchange %d %d %d\n", see_free, see_defended, see_xray);
+    } else {
+        printf("Success. Static exchange evaluation.\n");
+    }
+
+    // SAN names the file, rank or both of an ambiguous piece and marks mate.
+    char fen_san[] = "2k5/8/8/8/Q6Q/8/8/Q5K1 w - - 0 1";
+    parse_fen(b, fen_san);
+    char san_both[8], san_rank[8];
+    move_to_san(b, encode_move(24, 27, QUIET), san_both);
+    move_to_san(b, encode_move(0, 27, QUIET), san_rank);
+    char fen_san_mate[] = "6k1/5ppp/8/8/8/8/5PPP/R5K1 w - - 0 1";
+    parse_fen(b, fen_san_mate);
+    char san_mate[8];
+    move_to_san(b, encode_move(0, 56, QUIET), san_mate);
+    if (strcmp(san_both, "Qa4d4") || strcmp(san_rank, "Q1d4") || strcmp(san_mate, "Ra8#")) {
+        printf("Error standard algebraic notation %s %s %s\n", san_both, san_rank, san_mate);
+    } else {
+        printf("Success. Standard algebraic notation.\n");
+    }
+
+    // Back rank mate in one must be found and the board left as it was.
+    char fen_mate[] = "6k1/5ppp/8/8/8/8/5PPP/R5K1 w - - 0 1";
+    parse_fen(b, fen_mate);
+    uint64_t mate_key = b->key;
+    search_limits mate_limits = {.depth = 4};
+    search_info* mate_search = search_info_alloc(1);
+    move mate_move = search(b, NULL, &mate_limits, NULL, 1, mate_search);
+    if (mate_move != encode_move(0, 56, QUIET) || mate_search->score != MATE_SCORE - 1 || b->key != mate_key) {
+        printf("Error search mate in one %d score %d\n", mate_move, mate_search->score);
+    } else {
+        printf("Success. Search finds mate in one.\n");
+    }
+    search_info_delete(mate_search);
+
+    // Helper threads must stop with the main thread and agree on the mate.
+    char fen_smp[] = "6k1/5ppp/8/8/8/8/5PPP/R5K1 w - - 0 1";
+    parse_fen(b, fen_smp);
+    search_info* smp_search = search_info_alloc(4);
+    tt_table* smp_tt = tt_alloc(4);
+    move smp_move = search(b, NULL, &mate_limits, smp_tt, 4, smp_search);
+    if (smp_move != encode_move(0, 56, QUIET) || smp_search->score != MATE_SCORE - 1) {
+        printf("Error lazy smp search mate in one %d score %d\n", smp_move, smp_search->score);
+    } else {
+        printf("Success. Lazy SMP search finds mate in one.\n");
+    }
+    tt_delete(smp_tt);
+    search_info_delete(smp_search);
+
+    // Knights out and back repeat the start, seen through the game history.
+    set_standard(b);
+    game_history history = {.count = 0};
+    char* shuffle[] = {"g1f3", "g8f6", "f3g1", "f6g8"};
+    for (int i = 0; i < 4; i++) {
+        move_undo shuffle_undo;
+        history_push(&history, b);
+        do_move(b, parse_move(b, shuffle[i]), &shuffle_undo);
+    }
+    search_info* rep_search = search_info_alloc(1);
+    rep_search->b = b;
+    rep_search->history_count = history.count;
+    memcpy(rep_search->keys, history.keys, history.count * sizeof(uint64_t));
+    int repeated = is_repetition(rep_search);
+    b->halfmove = 3;
+    int window = is_repetition(rep_search);
+    if (history.count != 4 || !repeated || window) {
+        printf("Error repetition %d %d with %d keys\n", repeated, window, history.count);
+    } else {
+        printf("Success. Repetition found through game history.\n");
+    }
+    search_info_delete(rep_search);
+
+    // Any quiet move on the hundredth ply draws, however far ahead white is.
+    char fen_fifty[] = "7k/8/8/8/8/8/8/KQ6 w - - 99 80";
+    parse_fen(b, fen_fifty);
+    search_limits fifty_limits = {.depth = 3};
+    search_info* fifty_search = search_info_alloc(1);
+    search(b, NULL, &fifty_limits, NULL, 1, fifty_search);
+    if (fifty_search->score != 0) {
+        printf("Error fifty move rule score %d\n", fifty_search->score);
+    } else {
+        printf("Success. Fifty move rule draws.\n");
+    }
+    search_info_delete(fifty_search);
+
+    // A null move flips the side and clears en passant, and undoing it restores both.
+    char fen_null[] = "rnbqkbnr/ppp1pppp/8/3pP3/8/8/PPPP1PPP/RNBQKBNR w KQkq d6 0 2";
+    parse_fen(b, fen_null);
+    uint64_t null_key = b->key;
+    move_undo null_undo;
+    do_null_move(b, &null_undo);
+    int null_done = side_to_move(b) == BLACK && !en_passant_square(b) && b->key == compute_key(b);
+    undo_null_move(b, &null_undo);
+    if (!null_done || side_to_move(b) != WHITE || b->key != null_key || en_passant_square(b) != 43) {
+        printf("Error null move %d\n", null_done);
+    } else {
+        printf("Success. Null move round trip.\n");
+    }
+
+    // Stored search results read back with mate scores relative to the probing ply.
+    tt_table* tt = tt_alloc(1);
+    tt_store(tt, 0x1234, 3, encode_move(12, 28, DOUBLE_PUSH), MATE_SCORE - 5, 7, TT_EXACT);
+    move tt_move;
+    int tt_score, tt_depth, tt_bound;
+    int tt_found = tt_probe(tt, 0x1234, 1, &tt_move, &tt_score, &tt_depth, &tt_bound);
+    int tt_resized = tt_resize(tt, 2) && !tt_probe(tt, 0x1234, 1, &tt_move, &tt_score, &tt_depth, &tt_bound);
+    if (!tt_found || tt_move != encode_move(12, 28, DOUBLE_PUSH) || tt_score != MATE_SCORE - 3 \
+            || tt_depth != 7 || tt_bound != TT_EXACT || !tt_resized) {
+        printf("Error transposition table round trip %d %d %d\n", tt_found, tt_score, tt_depth);
+    } else {
+        printf("Success. Transposition table round trip.\n");
+    }
+    tt_delete(tt);
     free(b);
     return 0;
 }    
@@ -0,0 +1,74 @@
+#!/bin/sh
+# Smoke tests for the UCI front end. Builds it, feeds it command scripts and
+# checks each exits cleanly with one bestmove per go, including searches
+# stopped before their thread has started. Run from chess/test.
+
+cc=${CC:-gcc}
+bin=${TMPDIR:-/tmp}/chess-uci-smoke
+$cc -O2 -pthread -o "$bin" ../uci.c || exit 1
+
+failures=0
+
+# Runs commands $2 and expects $1 bestmove lines.
+check() {
+    out=$(printf "$2" | "$bin")
+    rc=$?
+    found=$(printf '%s\n' "$out" | grep -c '^bestmove')
+    if [ $rc -ne 0 ] || [ "$found" -ne "$1" ]; then
+        echo "Error rc $rc and $found bestmoves for: $2"
+        failures=$((failures + 1))
+    else
+        echo "Success. $2" | tr '\n' ' '
+        echo
+    fi
+}
+
+check 1 'go infinite\nstop\nquit\n'
+check 1 'go depth 2\nquit\n'
+check 1 'setoption name Threads value 2\ngo depth 2\nquit\n'
+check 1 'go infinite\n'
+check 2 'go movetime 50\nposition startpos moves e2e4\ngo infinite\nstop\nquit\n'
+check 1 'position fen 8/8/8/8/8/8/8/8 w - - 0 1\ngo depth 2\nquit\n'
+check 1 'go ponder wtime 1000 btime 1000\nstop\nquit\n'
+check 1 'go searchmoves e2e4 d2d4 depth 2\nquit\n'
+check 1 'position fen 4k3/8/8/8/8/8/8/8 w\ngo depth 2\nquit\n'
+
+# perft splits over the Threads workers and must still count the same nodes.
+for threads in 1 3; do
+    total=$(printf "setoption name Threads value $threads\nperft 4\nquit\n" | "$bin" | grep 'Nodes searched')
+    if [ "$total" != "Nodes searched: 197281" ]; then
+        echo "Error perft on $threads threads: $total"
+        failures=$((failures + 1))
+    else
+        echo "Success. perft on $threads threads."
+    fi
+done
+
+# Nothing of a search may follow its bestmove, the GUI would take it for the next one.
+last=$(printf 'go depth 3\nquit\n' | "$bin" | tail -n 1)
+case "$last" in
+    bestmove*) echo "Success. bestmove is the last line of a search." ;;
+    *) echo "Error output after bestmove: $last"; failures=$((failures + 1)) ;;
+esac
+
+# ponderhit must hand the ponder search its movetime, counted from the
+# ponderhit, instead of stopping it. bestmove should come about a second 
+# after the ponderhit and before the quit.
+start=$(date +%s%N)
+at=$( (printf 'go ponder movetime 1000\n'; sleep 0.3; printf 'ponderhit\n'; sleep 2; printf 'quit\n') \
+    | "$bin" | while read -r reply; do
+        case "$reply" in bestmove*) date +%s%N ;; esac
+    done)
+elapsed=$(( (${at:-$start} - start) / 1000000 ))
+if [ $elapsed -lt 1200 ] || [ $elapsed -gt 2200 ]; then
+    echo "Error ponderhit bestmove after $elapsed ms"
+    failures=$((failures + 1))
+else
+    echo "Success. ponderhit searched on for the movetime."
+fi
+
+if [ $failures -ne 0 ]; then
+    echo "Error $failures failures"
+    exit 1
+fi
+echo "Success. All UCI smoke tests passed."
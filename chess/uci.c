@@ -0,0 +1,371 @@
+#include "chess.c"
+
+/*
+ * UCI front end. Reads commands from stdin and writes replies to stdout.
+ * Searches run on a background thread so the command loop can still answer
+ * stop, isready and quit while the engine thinks.
+*/
+
+#define UCI_MAX_HASH 4096
+#define UCI_MAX_THREADS 256
+#define UCI_BENCH_DEPTH 9
+
+/*
+ * Search features exposed as check options, so each can be switched off 
+ * and measured on its own with bench.
+*/
+typedef struct uci_toggle {
+    char* name;
+    int* flag;
+} uci_toggle;
+
+uci_toggle uci_toggles[] = {
+    {"NullMove", &options.null_move},
+    {"LMR", &options.lmr},
+    {"Futility", &options.futility},
+    {"ReverseFutility", &options.reverse_futility},
+    {"Razoring", &options.razoring},
+    {"CheckExtensions", &options.check_extensions}
+};
+
+#define UCI_TOGGLE_COUNT (int) (sizeof(uci_toggles) / sizeof(uci_toggles[0]))
+
+typedef struct uci_engine {
+    board position;
+    // Positions of the game before position, for repetition detection.
+    game_history history;
+    tt_table* tt;
+    search_info* infos;
+    int threads;
+    search_limits limits;
+    // Set while a go ponder search runs, which waits for ponderhit to apply ponder_limits.
+    int pondering;
+    search_limits ponder_limits;
+    pthread_t thread;
+    // Set while the search thread runs, cleared by the thread once bestmove is sent.
+    int searching;
+    // Set once a search thread was started and has not yet been joined.
+    int joinable;
+} uci_engine;
+
+void* uci_search_thread(void* arg) {
+    uci_engine* e = arg;
+    search(&e->position, &e->history, &e->limits, e->tt, e->threads, e->infos);
+    __atomic_store_n(&e->searching, 0, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+/*
+ * Stops any running search and waits for its bestmove. The flag is set
+ * repeatedly because a search which has only just started clears it.
+*/
+void uci_stop(uci_engine* e) {
+    if (!e->joinable) return;
+    while (__atomic_load_n(&e->searching, __ATOMIC_ACQUIRE)) {
+        search_stop(e->infos);
+        struct timespec pause = {0, 100000};
+        nanosleep(&pause, NULL);
+    }
+    pthread_join(e->thread, NULL);
+    e->joinable = 0;
+    e->pondering = 0;
+}
+
+/*
+ * The opponent played the expected move, so the pondering search goes on 
+ * under the limits of its go command. Until the main thread has counted a 
+ * node the search may not yet have copied its limits, which would undo the 
+ * change, so it is applied again until then.
+*/
+void uci_ponderhit(uci_engine* e) {
+    if (!e->joinable || !e->pondering) return;
+    e->pondering = 0;
+    while (__atomic_load_n(&e->searching, __ATOMIC_ACQUIRE)) {
+        int started = __atomic_load_n(&e->infos->nodes, __ATOMIC_RELAXED) != 0;
+        search_ponderhit(e->infos, &e->ponder_limits);
+        if (started) break;
+        struct timespec pause = {0, 100000};
+        nanosleep(&pause, NULL);
+    }
+}
+
+/*
+ * Sets up the position from "position startpos|fen <fen> [moves ...]".
+ * An invalid fen leaves the previous position in place. Parsing stops at 
+ * the first illegal move.
+*/
+void uci_position(uci_engine* e, char* args) {
+    char* moves = strstr(args, "moves");
+    if (moves) {
+        // Cut the fen off before the move list, parse_fen tokenises its argument.
+        moves[-1] = '\0';
+        moves += strlen("moves");
+    }
+
+    if (!strncmp(args, "startpos", 8)) {
+        set_standard(&e->position);
+        e->history.count = 0;
+    } else if (!strncmp(args, "fen ", 4)) {
+        char fen[128];
+        snprintf(fen, sizeof(fen), "%s", args + 4);
+        // Move counters are optional in some GUIs' fens.
+        int spaces = 0;
+        for (char* c = fen; *c; c++) {
+            if (*c == ' ') spaces++;
+        }
+        if (spaces == 3) strncat(fen, " 0 1", sizeof(fen) - strlen(fen) - 1);
+        board position;
+        if (!parse_fen(&position, fen)) {
+            printf("info string invalid fen %s\n", args + 4);
+            return;
+        }
+        e->position = position;
+        e->history.count = 0;
+    } else {
+        printf("info string unknown position %s\n", args);
+        return;
+    }
+
+    if (!moves) return;
+    for (char* token = strtok(moves, " "); token; token = strtok(NULL, " ")) {
+        move m = parse_move(&e->position, token);
+        if (!m) {
+            printf("info string illegal move %s\n", token);
+            return;
+        }
+        move_undo undo;
+        history_push(&e->history, &e->position);
+        do_move(&e->position, m, &undo);
+    }
+}
+
+/*
+ * Milliseconds to spend on a move given the clock, increment and moves to
+ * the next time control. Keeps a margin for communication overhead.
+*/
+int64_t uci_move_time(int64_t time, int64_t increment, int moves_to_go) {
+    if (moves_to_go <= 0) moves_to_go = 30;
+    int64_t budget = time / moves_to_go + increment * 3 / 4;
+    int64_t limit = time - 50;
+    if (budget > limit) budget = limit;
+    return (budget > 1) ? budget: 1;
+}
+
+/*
+ * True if token has the shape of a move in UCI notation, eg. e2e4 or e7e8q.
+*/
+int uci_is_move(char* token) {
+    int length = strlen(token);
+    return (length == 4 || length == 5) && token[0] >= 'a' && token[0] <= 'h' \
+        && token[1] >= '1' && token[1] <= '8' && token[2] >= 'a' && token[2] <= 'h' \
+        && token[3] >= '1' && token[3] <= '8';
+}
+
+/*
+ * Starts a search for "go [depth n] [nodes n] [movetime ms] [wtime ms]
+ * [btime ms] [winc ms] [binc ms] [movestogo n] [infinite] [ponder]
+ * [searchmoves move ...]". A ponder search runs as infinite until stop, or 
+ * until ponderhit applies the other limits. searchmoves lists are skipped 
+ * and every root move searched.
+*/
+void uci_go(uci_engine* e, char* args) {
+    search_limits limits = {.depth = 0};
+    int64_t time[2] = {0, 0};
+    int64_t increment[2] = {0, 0};
+    int moves_to_go = 0;
+    int clock = 0;
+    int ponder = 0;
+    char* token = strtok(args, " ");
+    while (token) {
+        if (!strcmp(token, "infinite")) {
+            limits.infinite = 1;
+            token = strtok(NULL, " ");
+            continue;
+        }
+        if (!strcmp(token, "ponder")) {
+            ponder = 1;
+            token = strtok(NULL, " ");
+            continue;
+        }
+        if (!strcmp(token, "searchmoves")) {
+            do {
+                token = strtok(NULL, " ");
+            } while (token && uci_is_move(token));
+            continue;
+        }
+        char* value = strtok(NULL, " ");
+        if (!value) break;
+        if (!strcmp(token, "depth")) limits.depth = atoi(value);
+        else if (!strcmp(token, "nodes")) limits.nodes = strtoull(value, NULL, 10);
+        else if (!strcmp(token, "movetime")) limits.movetime = atoll(value);
+        else if (!strcmp(token, "wtime")) clock = 1, time[WHITE] = atoll(value);
+        else if (!strcmp(token, "btime")) clock = 1, time[BLACK] = atoll(value);
+        else if (!strcmp(token, "winc")) increment[WHITE] = atoll(value);
+        else if (!strcmp(token, "binc")) increment[BLACK] = atoll(value);
+        else if (!strcmp(token, "movestogo")) moves_to_go = atoi(value);
+        token = strtok(NULL, " ");
+    }
+    if (clock && !limits.movetime && !limits.infinite) {
+        int side = side_to_move(&e->position);
+        limits.movetime = uci_move_time(time[side], increment[side], moves_to_go);
+    }
+    e->pondering = ponder;
+    if (ponder) {
+        e->ponder_limits = limits;
+        limits.movetime = 0;
+        limits.infinite = 1;
+    }
+    // uci_ponderhit waits for the main thread's first node.
+    e->infos->nodes = 0;
+
+    e->limits = limits;
+    e->searching = 1;
+    if (pthread_create(&e->thread, NULL, uci_search_thread, e)) {
+        printf("info string search thread failed to start\n");
+        e->searching = 0;
+        return;
+    }
+    e->joinable = 1;
+}
+
+/*
+ * Handles "setoption name <name> value <value>" for Hash, Threads, Ponder 
+ * and the search toggles.
+*/
+void uci_setoption(uci_engine* e, char* args) {
+    char* name = strstr(args, "name ");
+    char* value = strstr(args, " value ");
+    if (!name || !value) return;
+    name += strlen("name ");
+    *value = '\0';
+    value += strlen(" value ");
+    int n = atoi(value);
+
+    for (int i = 0; i < UCI_TOGGLE_COUNT; i++) {
+        if (!strcmp(name, uci_toggles[i].name)) {
+            *uci_toggles[i].flag = !strcmp(value, "true");
+            return;
+        }
+    }
+
+    if (!strcmp(name, "Hash")) {
+        if (n < 1) n = 1;
+        if (n > UCI_MAX_HASH) n = UCI_MAX_HASH;
+        if (!tt_resize(e->tt, n)) printf("info string failed to resize hash to %d MB\n", n);
+    } else if (!strcmp(name, "Threads")) {
+        if (n < 1) n = 1;
+        if (n > UCI_MAX_THREADS) n = UCI_MAX_THREADS;
+        search_info* infos = search_info_alloc(n);
+        if (!infos) return;
+        search_info_delete(e->infos);
+        e->infos = infos;
+        e->threads = n;
+    } else if (!strcmp(name, "Ponder")) {
+        // Only tells the GUI it may send go ponder, nothing to set.
+    } else {
+        printf("info string unknown option %s\n", name);
+    }
+}
+
+/*
+ * Handles "bench [depth] [threads]", searching the fixed bench positions 
+ * with the current options. Defaults to depth 9 on the configured threads.
+*/
+void uci_bench(uci_engine* e, char* args) {
+    int depth = UCI_BENCH_DEPTH;
+    int threads = e->threads;
+    sscanf(args, "%d %d", &depth, &threads);
+    if (depth < 1) depth = 1;
+    if (threads < 1) threads = 1;
+    if (threads > UCI_MAX_THREADS) threads = UCI_MAX_THREADS;
+    search_bench(depth, threads);
+}
+
+/*
+ * Handles "perft <depth>", printing the count after each root move and the total.
+ * With more than one Threads the work is split over that many perft workers.
+*/
+void uci_perft(uci_engine* e, char* args) {
+    int depth = atoi(args);
+    if (depth < 1) depth = 1;
+    int64_t start = time_ms();
+    uint64_t nodes = (e->threads > 1) ? perft_divide_parallel(&e->position, depth, e->threads, NULL): \
+        perft_divide(&e->position, depth);
+    int64_t elapsed = time_ms() - start;
+    printf("\nNodes searched: %" PRIu64 "\n", nodes);
+    printf("info nodes %" PRIu64 " time %" PRId64 " nps %" PRIu64 "\n", \
+           nodes, elapsed, (elapsed) ? nodes * 1000 / elapsed: nodes * 1000);
+}
+
+int main(void) {
+    init_tables();
+    uci_engine e = {0};
+    e.tt = tt_alloc(16);
+    e.threads = 1;
+    e.infos = search_info_alloc(e.threads);
+    if (!e.tt || !e.infos) return 1;
+    set_standard(&e.position);
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    char line[8192];
+    while (fgets(line, sizeof(line), stdin)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        char* args = strchr(line, ' ');
+        if (args) {
+            *args++ = '\0';
+        } else {
+            args = line + strlen(line);
+        }
+
+        if (!strcmp(line, "uci")) {
+            printf("id name chess\n");
+            printf("id author chess authors\n");
+            printf("option name Hash type spin default 16 min 1 max %d\n", UCI_MAX_HASH);
+            printf("option name Threads type spin default 1 min 1 max %d\n", UCI_MAX_THREADS);
+            printf("option name Ponder type check default false\n");
+            for (int i = 0; i < UCI_TOGGLE_COUNT; i++) {
+                printf("option name %s type check default %s\n", uci_toggles[i].name, \
+                       (*uci_toggles[i].flag) ? "true": "false");
+            }
+            printf("uciok\n");
+        } else if (!strcmp(line, "isready")) {
+            printf("readyok\n");
+        } else if (!strcmp(line, "stop")) {
+            uci_stop(&e);
+        } else if (!strcmp(line, "ponderhit")) {
+            uci_ponderhit(&e);
+        } else if (!strcmp(line, "quit")) {
+            break;
+        } else if (!strcmp(line, "ucinewgame")) {
+            uci_stop(&e);
+            tt_clear(e.tt);
+        } else if (!strcmp(line, "position")) {
+            uci_stop(&e);
+            uci_position(&e, args);
+        } else if (!strcmp(line, "go")) {
+            uci_stop(&e);
+            uci_go(&e, args);
+        } else if (!strcmp(line, "setoption")) {
+            uci_stop(&e);
+            uci_setoption(&e, args);
+        } else if (!strcmp(line, "bench")) {
+            uci_stop(&e);
+            uci_bench(&e, args);
+        } else if (!strcmp(line, "perft")) {
+            uci_stop(&e);
+            uci_perft(&e, args);
+        } else if (!strcmp(line, "d")) {
+            char* b_str = board_string(&e.position);
+            printf("%s\n", b_str);
+            free(b_str);
+        } else if (line[0]) {
+            printf("info string unknown command %s\n", line);
+        }
+        fflush(stdout);
+    }
+
+    uci_stop(&e);
+    search_info_delete(e.infos);
+    tt_delete(e.tt);
+    return 0;
+}